@@ -1,7 +1,9 @@
 #pragma once
 
 #include <unordered_map>
+#include <map>
 #include <string>
+#include <vector>
 #include <stdexcept>
 
 /// Helper class to extract command-line arguments
@@ -9,6 +11,7 @@ class Arguments {
     
     bool help = false;
     std::unordered_map<std::string, std::string> args;
+    std::map<std::string, std::string>* recorded = nullptr; // see record
     
     template<typename T>
     T fromString (const std::string& str) const {
@@ -18,18 +21,24 @@ class Arguments {
         std::exit(1);
     }
     
+    template<typename T>
+    std::string canonical (const T& val) const {
+        // writes back a value read, in a single form for all the strings it could have been read from (e.g. "0.10" and ".1")
+        std::string name = typeName<T>();
+        std::printf("No specialization of canonical<%s> in Arguments class, cannot record %s types!\n", name.c_str(), name.c_str());
+        std::exit(1);
+    }
+    
     template<typename T>
     std::string typeName () const {
         return "unknown type";
     }
     
-public:
-    
-    Arguments(int argc, char** argv) {
+    // splits a command line into key/value pairs, a key without a value being set to "true"
+    void parse (const std::vector<std::string>& commandLine, std::unordered_map<std::string, std::string>& into) {
         std::string prevKey;
         bool hasPrevKey = false;
-        for (int i = 1; i < argc; ++i) {
-            std::string arg = std::string(argv[i]);
+        for (std::string arg : commandLine) {
             if (arg.length() > 0) {
                 
                 // passing 'help' as an argument turns on help mode, printing each key/type and exiting early
@@ -45,9 +54,9 @@ public:
                     if (arg[0] == '-') arg.erase(arg.begin()); // allow 2 dashes instead of 1 optionally
                     prevKey = arg;
                     hasPrevKey = true;
-                    args.insert({ arg, "true" });
+                    into.insert({ arg, "true" });
                 } else if (hasPrevKey) {
-                    args[prevKey] = arg;
+                    into[prevKey] = arg;
                     hasPrevKey = false;
                 } else {
                     std::printf("Error reading arguments: value '%s' is not bound to a key (did you mean '-%s'?)\n", arg.c_str(), arg.c_str());
@@ -58,6 +67,16 @@ public:
         }
     }
     
+public:
+    
+    Arguments(int argc, char** argv) {
+        parse(std::vector<std::string>(argv + 1, argv + argc), args);
+    }
+    
+    Arguments(const std::vector<std::string>& commandLine) {
+        parse(commandLine, args);
+    }
+    
     virtual ~Arguments () {
         if (args.size() > 0) {
             std::printf("Unused arguments, are you sure you meant to include these?\n%s", toString().c_str());
@@ -68,6 +87,20 @@ public:
         }
     }
     
+    /// Adds the arguments of another command line (e.g. that of a run being resumed), for the keys which were not passed on this one
+    void addDefaults (const std::vector<std::string>& commandLine) {
+        std::unordered_map<std::string, std::string> defaults;
+        parse(commandLine, defaults);
+        for (const auto& pair : defaults) {
+            args.insert(pair);
+        }
+    }
+    
+    /// From now on, records every key read into values, along with the value used (passed or default), e.g. to identify a run by all of its parameters
+    void record (std::map<std::string, std::string>& values) {
+        recorded = &values;
+    }
+    
     template<typename T>
     T read(const std::string& key, const T& defaultValue, bool required = false) {
         T val = defaultValue;
@@ -85,6 +118,9 @@ public:
             if (required) std::printf(" (required)");
             std::printf("\n");
         }
+        if (recorded != nullptr) {
+            (*recorded)[key] = canonical<T>(val);
+        }
         return val;
     }
     
@@ -106,12 +142,12 @@ public:
 
 
 template<>
-std::string Arguments::fromString<std::string>(const std::string& val) const {
+inline std::string Arguments::fromString<std::string>(const std::string& val) const {
     return val;
 }
 
 template<>
-bool Arguments::fromString<bool>(const std::string& val) const {
+inline bool Arguments::fromString<bool>(const std::string& val) const {
     if (val.rfind("true", 0) == 0 || val.rfind("1", 0) == 0 || val.rfind("True", 0) == 0) {
         return true;
     } else if (val.rfind("false", 0) == 0 || val.rfind("0", 0) == 0 || val.rfind("False", 0) == 0) {
@@ -123,7 +159,7 @@ bool Arguments::fromString<bool>(const std::string& val) const {
 }
 
 #define FROM_STRING_STD_STO_T(T, stot) \
-    template<> T Arguments::fromString<T>(const std::string& val) const { \
+    template<> inline T Arguments::fromString<T>(const std::string& val) const { \
         try { \
             return std::stot(val); \
         } catch (const std::invalid_argument& e) { \
@@ -139,8 +175,35 @@ FROM_STRING_STD_STO_T(float, stof);
 #undef FROM_STRING_STD_STO_T
 
 
+template<>
+inline std::string Arguments::canonical<std::string>(const std::string& val) const {
+    return val;
+}
+
+template<>
+inline std::string Arguments::canonical<bool>(const bool& val) const {
+    return val ? "true" : "false";
+}
+
+template<>
+inline std::string Arguments::canonical<int>(const int& val) const {
+    return std::to_string(val);
+}
+
+template<>
+inline std::string Arguments::canonical<float>(const float& val) const {
+    // shortest form reading back as the same value
+    char str[32];
+    for (int precision = 6; precision <= 9; ++precision) {
+        std::snprintf(str, sizeof(str), "%.*g", precision, val);
+        if (std::strtof(str, nullptr) == val) break;
+    }
+    return str;
+}
+
+
 #define TYPE_NAME(T) \
-    template<> std::string Arguments::typeName<T>() const { return #T; }
+    template<> inline std::string Arguments::typeName<T>() const { return #T; }
 TYPE_NAME(std::string);
 TYPE_NAME(int);
 TYPE_NAME(float);
@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <string>
+#include <cstring>
+#include <cassert>
 
 #include "Vec.h"
 
@@ -14,14 +16,9 @@ public:
 	/// Writes a value of trivial type T (no pointers) to data as bytes
 	template<typename T>
 	static void writeSimple(std::vector<std::uint8_t>& data, const T& val) {
-		union {
-			T original;
-			std::uint8_t bytes[sizeof(T)];
-		} o2b = {};
-		o2b.original = val;
-		for (std::size_t i = 0; i < sizeof(T); ++i) {
-			data.push_back(o2b.bytes[i]);
-		}
+		std::size_t start = data.size();
+		data.resize(start + sizeof(T));
+		std::memcpy(&data[start], &val, sizeof(T));
 	}
 
 	/// Reads a value of trivial type T (no pointers) from data as bytes
@@ -57,6 +54,22 @@ public:
         return s;
     }
     
+	/// Writes count values of trivial type T as bytes, in a single copy
+	template<typename T>
+	static void writeArray (std::vector<std::uint8_t>& data, const T* values, std::size_t count) {
+		std::size_t start = data.size();
+		data.resize(start + count * sizeof(T));
+		std::memcpy(&data[start], values, count * sizeof(T));
+	}
+
+	/// Reads count values of trivial type T from data as bytes, in a single copy
+	template<typename T>
+	static void readArray (const std::vector<std::uint8_t>& data, size_t& at, T* values, std::size_t count) {
+		assert(at + count * sizeof(T) <= data.size());
+		std::memcpy(values, &data[at], count * sizeof(T));
+		at += count * sizeof(T);
+	}
+    
 	template<int N, typename T>
 	static void writeVec (std::vector<std::uint8_t>& data, const Vec<N, T>& val) {
 		for (int i = 0; i < N; ++i) {
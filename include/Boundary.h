@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "Vec.h"
+#include "VecUtils.h"
+#include "ParticleStore.h"
+
+/// What happens to particles reaching the circular (spherical in 3D) wall of radius boundary around the origin
+enum class Wall : std::uint8_t {
+    None,    // no wall
+    Escape,  // particles bounce off the wall, except around its +X pole, through which they escape (i.e. are frozen there)
+    Reflect, // particles bounce off the wall everywhere
+    Absorb   // particles stick to the wall wherever they hit it (i.e. are frozen there)
+};
+
+/// Boundary conditions applied to each particle at the end of its update, as a compile-time policy
+/// The update loops of the models are instantiated once per combination (see Boundary::dispatch), and selected once per timestep:
+/// each particle then only pays for the checks of the boundary actually in use, and adding a new kind of wall does not slow down the others
+template<int D, bool Periodic, Wall W>
+struct BoundaryPolicy {
+
+    /// images, if not null, holds the periodic image of each particle along each axis, updated as it wraps around the box (see Model::enableObservables)
+    static inline void apply (ParticleView<D> particle, float periodicity, float boundary, std::int32_t* const* images) {
+        Vec<D> pos = particle.pos();
+
+        // ensure periodic domain, [-periodicity, periodicity) along each axis
+        // particles move by less than the size of the box per timestep, so a single conditional wrap is enough, which compiles to selects rather than branches
+        if constexpr (Periodic) {
+            for (int d = 0; d < D; ++d) {
+                float x = pos[d];
+                if (images != nullptr) images[d][particle.index()] += (x >= periodicity ? 1 : 0) - (x < -periodicity ? 1 : 0);
+                x = x >= periodicity ? x - 2 * periodicity : x;
+                x = x < -periodicity ? x + 2 * periodicity : x;
+                pos.set(d, x);
+            }
+        }
+
+        // apply boundary condition
+        if constexpr (W != Wall::None) {
+            if (pos.clampLength(boundary)) {
+                if constexpr (W == Wall::Absorb) {
+                    particle.setFrozen(true);
+                } else {
+                    // when hitting the boundary, bounce off
+                    particle.setDirection(pos.normalized() * -1);
+
+                    // particles that hit the boundary in the right spot (down the X axis) are considered to have "escaped"
+                    if constexpr (W == Wall::Escape) {
+                        if (pos.X() >= boundary * 0.999) {
+                            particle.setFrozen(true);
+                        }
+                    }
+                }
+            }
+        }
+
+        particle.setPos(pos);
+    }
+
+};
+
+class Boundary {
+    Boundary()=delete;
+    Boundary(const Boundary&)=delete;
+    Boundary(Boundary&&)=delete;
+
+    template<int D, bool Periodic, typename F>
+    static void dispatchWall (Wall wall, F&& f) {
+        switch (wall) {
+            case Wall::None: f(BoundaryPolicy<D, Periodic, Wall::None>()); break;
+            case Wall::Escape: f(BoundaryPolicy<D, Periodic, Wall::Escape>()); break;
+            case Wall::Reflect: f(BoundaryPolicy<D, Periodic, Wall::Reflect>()); break;
+            case Wall::Absorb: f(BoundaryPolicy<D, Periodic, Wall::Absorb>()); break;
+        }
+    }
+
+public:
+
+    /// Calls f with an instance of the BoundaryPolicy matching the given domain (periodic when periodicity > 0) and wall
+    template<int D, typename F>
+    static void dispatch (float periodicity, Wall wall, F&& f) {
+        if (periodicity > 0) {
+            dispatchWall<D, true>(wall, f);
+        } else {
+            dispatchWall<D, false>(wall, f);
+        }
+    }
+
+    /// Wall type from its name, as passed to -boundary-type; returns false for unknown names
+    static bool parse (const std::string& name, Wall& wall) {
+        if (name.compare("escape") == 0) wall = Wall::Escape;
+        else if (name.compare("reflect") == 0) wall = Wall::Reflect;
+        else if (name.compare("absorb") == 0) wall = Wall::Absorb;
+        else return false;
+        return true;
+    }
+
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include "Vec.h"
+
+/// Uniform grid spatial index, bucketing particle indices by cell so that neighbour queries only visit the cells surrounding a position
+/// Cells are at least as wide as the interaction radius, hence any particle within that radius lies in one of the 3^D cells around the query point
+template<int D>
+class CellList {
+
+    int cellsPerDim[D];
+    float origin[D];
+    float cellSize[D];
+    bool periodic = false;
+
+    std::vector<std::uint32_t> particleCells; // cell index of each particle
+    std::vector<std::uint32_t> cellStart; // offsets into cellParticles, one entry per cell plus one
+    std::vector<std::uint32_t> cellParticles; // particle indices, sorted by cell
+
+    inline int cellCoord (float x, int d) const {
+        int c = int(std::floor((x - origin[d]) / cellSize[d]));
+        return c < 0 ? 0 : c >= cellsPerDim[d] ? cellsPerDim[d] - 1 : c;
+    }
+
+    inline std::uint32_t cellIndex (const int* coords) const {
+        std::uint32_t idx = 0;
+        for (int d = D-1; d >= 0; --d) {
+            idx = idx * cellsPerDim[d] + coords[d];
+        }
+        return idx;
+    }
+
+public:
+
+    /// Rebuilds the grid from count positions, where position(i) returns the Vec<D> position of particle i
+    /// periodicity > 0 denotes a periodic domain spanning [-periodicity, periodicity) along each axis; otherwise the grid fits the particles' bounding box
+    template<typename PosFn>
+    void build (std::size_t count, PosFn position, float radius, float periodicity);
+
+    /// Calls f(const std::uint32_t* indices, std::size_t n) for each (distinct) cell neighbouring pos, including its own cell
+    template<typename F>
+    void forEachCell (const Vec<D>& pos, F&& f) const;
+
+    /// Calls f(std::size_t j) for each particle j stored in a cell neighbouring pos; this includes particles further than the radius, which callers must discard
+    template<typename F>
+    void forEachCandidate (const Vec<D>& pos, F&& f) const {
+        forEachCell(pos, [&f](const std::uint32_t* indices, std::size_t n) {
+            for (std::size_t k = 0; k < n; ++k) f(std::size_t(indices[k]));
+        });
+    }
+
+};
+
+
+
+template<int D>
+template<typename PosFn>
+void CellList<D>::build (std::size_t count, PosFn position, float radius, float periodicity) {
+
+    // never allocate (much) more cells than there are particles, so sparse or wide domains do not blow up memory use
+    std::size_t maxCells = std::max<std::size_t>(4 * count, 64);
+    int maxPerDim = std::max(1, int(std::pow(double(maxCells), 1.0 / D)));
+
+    periodic = periodicity > 0;
+    if (periodic) {
+        // cells tile the periodic box exactly, so that wrapping around the domain maps onto whole cells
+        for (int d = 0; d < D; ++d) {
+            origin[d] = -periodicity;
+            cellsPerDim[d] = std::min(maxPerDim, std::max(1, int(2 * periodicity / radius)));
+            cellSize[d] = 2 * periodicity / cellsPerDim[d];
+        }
+    } else {
+        // fit the grid to the bounding box of all particles
+        float lo[D], hi[D];
+        for (int d = 0; d < D; ++d) {
+            float dMin = std::numeric_limits<float>::max(), dMax = std::numeric_limits<float>::lowest();
+            #pragma omp parallel for reduction(min: dMin) reduction(max: dMax)
+            for (std::size_t i = 0; i < count; ++i) {
+                float x = position(i)[d];
+                dMin = std::min(dMin, x);
+                dMax = std::max(dMax, x);
+            }
+            lo[d] = count > 0 ? dMin : 0.0f;
+            hi[d] = count > 0 ? dMax : 0.0f;
+        }
+        for (int d = 0; d < D; ++d) {
+            origin[d] = lo[d];
+            cellsPerDim[d] = std::min(maxPerDim, std::max(1, int((hi[d] - lo[d]) / radius)));
+            cellSize[d] = std::max(radius, (hi[d] - lo[d]) / cellsPerDim[d]);
+        }
+    }
+
+    std::size_t cellCount = 1;
+    for (int d = 0; d < D; ++d) cellCount *= cellsPerDim[d];
+
+    // bin each particle
+    particleCells.resize(count);
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < count; ++i) {
+        Vec<D> p = position(i);
+        int coords[D];
+        for (int d = 0; d < D; ++d) coords[d] = cellCoord(p[d], d);
+        particleCells[i] = cellIndex(coords);
+    }
+
+    // counting sort of the particle indices by cell; stable, so particles within a cell remain in index order
+    cellStart.assign(cellCount + 1, 0);
+    for (std::size_t i = 0; i < count; ++i) {
+        ++cellStart[particleCells[i] + 1];
+    }
+    for (std::size_t c = 0; c < cellCount; ++c) {
+        cellStart[c + 1] += cellStart[c];
+    }
+    cellParticles.resize(count);
+    std::vector<std::uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+    for (std::size_t i = 0; i < count; ++i) {
+        cellParticles[fill[particleCells[i]]++] = std::uint32_t(i);
+    }
+}
+
+template<int D>
+template<typename F>
+void CellList<D>::forEachCell (const Vec<D>& pos, F&& f) const {
+
+    // range of cells to visit along each axis; with fewer than 3 cells per axis in a periodic domain, visit each cell once rather than wrapping onto the same cell twice
+    int from[D], to[D];
+    for (int d = 0; d < D; ++d) {
+        int c = cellCoord(pos[d], d);
+        if (periodic && cellsPerDim[d] < 3) {
+            from[d] = 0;
+            to[d] = cellsPerDim[d] - 1;
+        } else if (periodic) {
+            from[d] = c - 1;
+            to[d] = c + 1;
+        } else {
+            from[d] = std::max(c - 1, 0);
+            to[d] = std::min(c + 1, cellsPerDim[d] - 1);
+        }
+    }
+
+    // iterate over the D-dimensional block of cells
+    int coords[D];
+    for (int d = 0; d < D; ++d) coords[d] = from[d];
+    while (true) {
+        int wrapped[D];
+        for (int d = 0; d < D; ++d) {
+            wrapped[d] = coords[d] < 0 ? coords[d] + cellsPerDim[d] : coords[d] >= cellsPerDim[d] ? coords[d] - cellsPerDim[d] : coords[d];
+        }
+        std::uint32_t cell = cellIndex(wrapped);
+        std::uint32_t begin = cellStart[cell], end = cellStart[cell + 1];
+        if (end > begin) {
+            f(&cellParticles[begin], std::size_t(end - begin));
+        }
+
+        int d = 0;
+        while (d < D && coords[d] == to[d]) {
+            coords[d] = from[d];
+            ++d;
+        }
+        if (d == D) break;
+        ++coords[d];
+    }
+}
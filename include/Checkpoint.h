@@ -0,0 +1,248 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include "BinaryIO.h"
+#include "Profiler.h"
+
+/// Run-level information stored in a checkpoint, along with the model state
+struct CheckpointInfo {
+    std::uint64_t iteration = 0; // next iteration of the main loop to run
+    std::uint32_t seed = 0;
+    std::vector<std::string> commandLine; // arguments the run was started with, which hold all model and output parameters
+    std::uint64_t trajectoryBytes = 0;   // size of the output file when the checkpoint was taken
+    std::vector<std::uint64_t> frameOffsets; // offset of each frame written to the output file until then
+};
+
+/// Checkpoint files, holding everything needed to carry on an interrupted run bit-exactly
+/// All values are little-endian:
+///   "AMMC" | u32 version | u64 file size | u64 iteration | u32 seed | u32 argument count | arguments (null-terminated)
+///   | u64 output file size | u64 frame count | u64 offset of each frame | model state (see ModelBase::saveState)
+class Checkpoint {
+    Checkpoint()=delete;
+    Checkpoint(const Checkpoint&)=delete;
+    Checkpoint(Checkpoint&&)=delete;
+public:
+
+    static constexpr std::uint32_t Version = 5;
+
+    /// Appends the run information to data, which the model state should follow, then calls to finish
+    static void begin (std::vector<std::uint8_t>& data, const CheckpointInfo& info);
+
+    /// Records the final size of the checkpoint in data
+    static void finish (std::vector<std::uint8_t>& data);
+
+    /// Loads the checkpoint file at path into data and reads its run information; at is set to the start of the model state
+    static void read (const std::string& path, std::vector<std::uint8_t>& data, CheckpointInfo& info, std::size_t& at);
+
+};
+
+/// Writes checkpoints from a dedicated thread, so that the simulation only pays for copying its state into a buffer
+/// Each checkpoint is written to a temporary file, flushed to the storage device, then renamed over the previous one: the file at path thus always holds
+/// a complete checkpoint, even if the process is killed midway through writing the next one
+class CheckpointWriter {
+
+    std::string path;
+
+    std::vector<std::uint8_t> buffers[2];
+    std::size_t filling = 0; // buffer handed out by acquire(); the other one may be being written
+    bool pending = false;    // a checkpoint has been submitted and is not committed yet
+    bool closing = false;
+    std::function<void()> beforeCommit;
+
+    std::mutex mutex;
+    std::condition_variable submitted, committed;
+    std::thread writer;
+
+    std::size_t checkpointsWritten = 0;
+    double stallSeconds = 0.0; // time spent by the simulation thread waiting on the previous checkpoint
+
+    void writeLoop ();
+    void commit (const std::vector<std::uint8_t>& data);
+
+public:
+
+    CheckpointWriter (const std::string& path);
+    CheckpointWriter (const CheckpointWriter&)=delete;
+    CheckpointWriter (CheckpointWriter&&)=delete;
+
+    ~CheckpointWriter () { close(); }
+
+    /// Returns an empty buffer to serialize the next checkpoint into
+    std::vector<std::uint8_t>& acquire ();
+
+    /// Queues the buffer returned by acquire() for writing, after waiting for the previous checkpoint to be committed
+    /// beforeCommit, if any, runs on the writer thread right before the checkpoint replaces the previous one (e.g. to make sure the frames it refers to are on disk)
+    void submit (std::function<void()> beforeCommit = nullptr);
+
+    /// Commits the last checkpoint submitted, then stops the writer thread; called by the destructor if not done explicitly
+    void close ();
+
+    std::size_t getCheckpointsWritten () const { return checkpointsWritten; }
+    double getStallSeconds () const { return stallSeconds; }
+
+};
+
+
+
+inline void Checkpoint::begin (std::vector<std::uint8_t>& data, const CheckpointInfo& info) {
+    data.push_back('A');
+    data.push_back('M');
+    data.push_back('M');
+    data.push_back('C');
+    BinIO::writeSimple<std::uint32_t>(data, Version);
+    BinIO::writeSimple<std::uint64_t>(data, 0); // file size, see finish
+    BinIO::writeSimple<std::uint64_t>(data, info.iteration);
+    BinIO::writeSimple<std::uint32_t>(data, info.seed);
+    BinIO::writeSimple<std::uint32_t>(data, std::uint32_t(info.commandLine.size()));
+    for (const std::string& arg : info.commandLine) {
+        BinIO::writeString(data, arg);
+    }
+    BinIO::writeSimple<std::uint64_t>(data, info.trajectoryBytes);
+    BinIO::writeSimple<std::uint64_t>(data, info.frameOffsets.size());
+    BinIO::writeArray(data, info.frameOffsets.data(), info.frameOffsets.size());
+}
+
+inline void Checkpoint::finish (std::vector<std::uint8_t>& data) {
+    std::uint64_t size = data.size();
+    std::memcpy(&data[8], &size, sizeof(size));
+}
+
+inline void Checkpoint::read (const std::string& path, std::vector<std::uint8_t>& data, CheckpointInfo& info, std::size_t& at) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        std::printf("Could not open checkpoint %s!\n", path.c_str());
+        std::exit(1);
+    }
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    data.resize(size > 0 ? std::size_t(size) : 0);
+    bool complete = size > 0 && std::fread(data.data(), 1, data.size(), file) == data.size();
+    std::fclose(file);
+
+    at = 4;
+    if (!complete || data.size() < 16 || std::memcmp(data.data(), "AMMC", 4) != 0) {
+        std::printf("%s is not a checkpoint file!\n", path.c_str());
+        std::exit(1);
+    }
+    std::uint32_t version = BinIO::readSimple<std::uint32_t>(data, at);
+    std::uint64_t recordedSize = BinIO::readSimple<std::uint64_t>(data, at);
+    if (version != Version || recordedSize != data.size()) {
+        std::printf("Checkpoint %s is truncated, or was written by an incompatible version!\n", path.c_str());
+        std::exit(1);
+    }
+    info.iteration = BinIO::readSimple<std::uint64_t>(data, at);
+    info.seed = BinIO::readSimple<std::uint32_t>(data, at);
+    info.commandLine.resize(BinIO::readSimple<std::uint32_t>(data, at));
+    for (std::string& arg : info.commandLine) {
+        arg = BinIO::readString(data, at);
+    }
+    info.trajectoryBytes = BinIO::readSimple<std::uint64_t>(data, at);
+    info.frameOffsets.resize(BinIO::readSimple<std::uint64_t>(data, at));
+    BinIO::readArray(data, at, info.frameOffsets.data(), info.frameOffsets.size());
+}
+
+inline CheckpointWriter::CheckpointWriter (const std::string& path) : path(path) {
+    writer = std::thread(&CheckpointWriter::writeLoop, this);
+}
+
+inline std::vector<std::uint8_t>& CheckpointWriter::acquire () {
+    // the writer thread only ever reads the other buffer, so this one is free to fill
+    std::vector<std::uint8_t>& buffer = buffers[filling];
+    buffer.clear();
+    return buffer;
+}
+
+inline void CheckpointWriter::submit (std::function<void()> beforeCommit) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (pending) {
+            auto start = std::chrono::steady_clock::now();
+            committed.wait(lock, [this]() { return !pending; });
+            stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        this->beforeCommit = beforeCommit;
+        filling = 1 - filling;
+        pending = true;
+    }
+    submitted.notify_one();
+}
+
+inline void CheckpointWriter::close () {
+    if (!writer.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    submitted.notify_one();
+    writer.join();
+}
+
+inline void CheckpointWriter::writeLoop () {
+    if (Profiler::enabled()) Profiler::nameThread("checkpoint writer");
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            submitted.wait(lock, [this]() { return pending || closing; });
+            if (!pending) break; // closing, and the last checkpoint has been committed
+        }
+
+        // the submitted buffer is not touched by the simulation thread until pending is reset, so the write happens outside the lock
+        commit(buffers[1 - filling]);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = false;
+            ++checkpointsWritten;
+        }
+        committed.notify_one();
+    }
+}
+
+inline void CheckpointWriter::commit (const std::vector<std::uint8_t>& data) {
+    PROFILE_SCOPE("write checkpoint");
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::printf("Could not open checkpoint file %s for writing!\n", temporary.c_str());
+        std::exit(1);
+    }
+    for (std::size_t at = 0; at < data.size(); ) {
+        ssize_t written = ::write(fd, data.data() + at, data.size() - at);
+        if (written <= 0) {
+            std::printf("Error writing checkpoint file %s!\n", temporary.c_str());
+            std::exit(1);
+        }
+        at += std::size_t(written);
+    }
+    if (::fsync(fd) != 0 || ::close(fd) != 0) {
+        std::printf("Error syncing checkpoint file %s to disk!\n", temporary.c_str());
+        std::exit(1);
+    }
+
+    if (beforeCommit) beforeCommit();
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::printf("Could not replace checkpoint file %s!\n", path.c_str());
+        std::exit(1);
+    }
+
+    // the rename itself only survives a crash once the directory holding the file is synced too
+    std::size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <mpi.h>
+#include "Trajectory.h"
+#include "ParticleStore.h"
+#include "VecUtils.h"
+
+/// Version 2 trajectory output (see Trajectory) of a model whose particles are distributed across processes (see DomainDecomposition)
+/// Each process is responsible for writing a contiguous range of global particle indices: for each frame, particle data is first sent to the process
+/// responsible for it, then every process writes its range of each array of the frame through MPI-IO, in collective calls
+/// Files are laid out exactly as those of a single-process run, so all readers apply; compressed frames are not supported
+template<int D>
+class DistributedTrajectory {
+
+    MPI_Comm comm;
+    int rank, processes;
+    MPI_File file;
+    bool open = false;
+    TrajectoryHeader header;
+    std::size_t headerSize, frameSize;
+    std::uint64_t first, count; // range of global indices written by this process
+    std::vector<std::uint64_t> frameOffsets;
+
+    // a particle is sent as its global index, then its D positions and its orientation components
+    std::size_t recordBytes;
+    MPI_Datatype recordType;
+    std::vector<std::uint8_t> outgoing, incoming;
+    std::vector<float> arrays[2 * D]; // values of this process' range, one array per position then orientation component
+    std::vector<std::uint16_t> quantised;
+
+    // first global index of the range written by process p
+    inline std::uint64_t firstOf (int p) const { return header.particleCount * std::uint64_t(p) / processes; }
+    // process writing global index i, i.e. the last one whose range starts at or before i
+    inline int writerOf (std::uint64_t i) const { return int(((i + 1) * processes - 1) / header.particleCount); }
+
+public:
+
+    /// Creates the file at path (collective call), header.particleCount being the total number of particles over all processes
+    DistributedTrajectory (const std::string& path, const TrajectoryHeader& header, MPI_Comm comm);
+    DistributedTrajectory (const DistributedTrajectory&)=delete;
+    DistributedTrajectory (DistributedTrajectory&&)=delete;
+
+    ~DistributedTrajectory () { close(); }
+
+    /// Writes the frame of the given timestep, from the particles held by this process and their global indices (collective call)
+    void writeFrame (std::uint64_t step, const ParticleStore<D>& particles, const std::vector<std::uint64_t>& ids);
+
+    /// Appends the frame index and closes the file (collective call); called by the destructor if not done explicitly
+    void close ();
+
+    std::size_t getFramesWritten () const { return frameOffsets.size(); }
+    std::uint64_t getBytesWritten () const { return headerSize + frameOffsets.size() * frameSize; }
+
+};
+
+
+
+template<int D>
+DistributedTrajectory<D>::DistributedTrajectory (const std::string& path, const TrajectoryHeader& header, MPI_Comm comm) : comm(comm), header(header) {
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &processes);
+    if (header.compressed()) {
+        if (rank == 0) std::printf("Compressed trajectories cannot be written when particles are distributed across processes!\n");
+        MPI_Abort(comm, 1);
+    }
+    headerSize = Trajectory::headerSize(header);
+    frameSize = header.frameSize();
+    first = firstOf(rank);
+    count = firstOf(rank + 1) - first;
+    for (std::size_t k = 0; k < D + header.orientationComponents(); ++k) arrays[k].resize(count);
+    recordBytes = sizeof(std::uint64_t) + (D + header.orientationComponents()) * sizeof(float);
+    MPI_Type_contiguous(int(recordBytes), MPI_BYTE, &recordType);
+    MPI_Type_commit(&recordType);
+
+    if (MPI_File_open(comm, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        if (rank == 0) std::printf("Could not open output file %s for writing!\n", path.c_str());
+        MPI_Abort(comm, 1);
+    }
+    open = true;
+    MPI_File_set_size(file, 0);
+    if (rank == 0) {
+        std::vector<std::uint8_t> data;
+        Trajectory::writeHeader(data, header);
+        MPI_File_write_at(file, 0, data.data(), int(data.size()), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+}
+
+template<int D>
+void DistributedTrajectory<D>::writeFrame (std::uint64_t step, const ParticleStore<D>& particles, const std::vector<std::uint64_t>& ids) {
+    std::size_t components = D + header.orientationComponents();
+
+    // bucket the particles held here by the process writing them
+    std::vector<int> sendCounts(processes, 0), receiveCounts(processes), sendOffsets(processes, 0), receiveOffsets(processes, 0);
+    for (std::size_t i = 0; i < particles.size(); ++i) ++sendCounts[writerOf(ids[i])];
+    for (int p = 1; p < processes; ++p) sendOffsets[p] = sendOffsets[p - 1] + sendCounts[p - 1];
+    outgoing.resize(particles.size() * recordBytes);
+    std::vector<int> fill(sendOffsets);
+    for (std::size_t i = 0; i < particles.size(); ++i) {
+        float values[2 * D];
+        for (int d = 0; d < D; ++d) values[d] = particles.positions[d][i];
+        if (header.orientations == OrientationEncoding::Directions) {
+            Vec<D> dir = VecUtils::toCartesian<D>(particles.rotation(i));
+            for (int d = 0; d < D; ++d) values[D + d] = dir[d];
+        } else if (header.orientations == OrientationEncoding::Angles) {
+            for (int d = 0; d < D-1; ++d) values[D + d] = particles.rotations[d][i];
+        }
+        std::uint8_t* out = &outgoing[std::size_t(fill[writerOf(ids[i])]++) * recordBytes];
+        std::memcpy(out, &ids[i], sizeof(std::uint64_t));
+        std::memcpy(out + sizeof(std::uint64_t), values, components * sizeof(float));
+    }
+
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, receiveCounts.data(), 1, MPI_INT, comm);
+    for (int p = 1; p < processes; ++p) receiveOffsets[p] = receiveOffsets[p - 1] + receiveCounts[p - 1];
+    incoming.resize(std::size_t(receiveOffsets[processes - 1] + receiveCounts[processes - 1]) * recordBytes);
+    MPI_Alltoallv(outgoing.data(), sendCounts.data(), sendOffsets.data(), recordType,
+        incoming.data(), receiveCounts.data(), receiveOffsets.data(), recordType, comm);
+
+    // scatter into this process' range of each array
+    for (std::size_t at = 0; at < incoming.size(); at += recordBytes) {
+        std::uint64_t index;
+        float values[2 * D];
+        std::memcpy(&index, &incoming[at], sizeof(index));
+        std::memcpy(values, &incoming[at + sizeof(index)], components * sizeof(float));
+        for (std::size_t k = 0; k < components; ++k) arrays[k][index - first] = values[k];
+    }
+
+    // step, then each array; the padding between arrays is left as a hole in the file, which reads as zeros
+    MPI_Offset frameStart = MPI_Offset(headerSize + frameOffsets.size() * frameSize);
+    if (rank == 0) {
+        MPI_File_write_at(file, frameStart, &step, 1, MPI_UINT64_T, MPI_STATUS_IGNORE);
+    }
+    for (int d = 0; d < D; ++d) {
+        MPI_Offset offset = frameStart + MPI_Offset(header.positionsOffset(d) + first * header.positionBytes());
+        if (header.positions == PositionEncoding::Fixed16) {
+            quantised.resize(count);
+            for (std::size_t i = 0; i < count; ++i) quantised[i] = Trajectory::quantise(arrays[d][i], header.periodicity);
+            MPI_File_write_at_all(file, offset, quantised.data(), int(count), MPI_UINT16_T, MPI_STATUS_IGNORE);
+        } else {
+            MPI_File_write_at_all(file, offset, arrays[d].data(), int(count), MPI_FLOAT, MPI_STATUS_IGNORE);
+        }
+    }
+    for (std::uint32_t d = 0; d < header.orientationComponents(); ++d) {
+        MPI_Offset offset = frameStart + MPI_Offset(header.orientationsOffset(d) + first * sizeof(float));
+        MPI_File_write_at_all(file, offset, arrays[D + d].data(), int(count), MPI_FLOAT, MPI_STATUS_IGNORE);
+    }
+    frameOffsets.push_back(std::uint64_t(frameStart));
+}
+
+template<int D>
+void DistributedTrajectory<D>::close () {
+    if (!open) return;
+    if (rank == 0) {
+        std::vector<std::uint8_t> data;
+        Trajectory::writeIndex(data, frameOffsets);
+        MPI_File_write_at(file, MPI_Offset(getBytesWritten()), data.data(), int(data.size()), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&file);
+    MPI_Type_free(&recordType);
+    open = false;
+}
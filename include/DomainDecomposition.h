@@ -0,0 +1,256 @@
+#pragma once
+
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <mpi.h>
+#include "ParticleStore.h"
+#include "models/DoubleBufferedModel.h"
+
+/// Spatial decomposition of the periodic box [-periodicity, periodicity)^D across the processes of an MPI communicator, arranged as a Cartesian grid
+/// Each process holds the particles within its own subdomain, and at the start of each timestep:
+///  - particles which moved out of it are handed over to the neighbouring process, one axis after the other, so that particles crossing an edge or a corner
+///    reach the diagonal neighbour in two or three hops
+///  - copies of the particles lying within the interaction radius of its faces are received from its neighbours (the halo), one axis after the other too,
+///    forwarding the copies received along earlier axes so that edge and corner neighbours are covered
+/// Particles must move less than a subdomain per timestep, and subdomains must be at least as wide as the interaction radius
+/// Work is balanced as long as the density is roughly uniform, since each subdomain spans the same volume
+template<int D>
+class DomainDecomposition : public ParticleExchange<D> {
+
+    MPI_Comm comm;
+    int rank, processes;
+    int dims[D], coords[D];
+    int lower[D], upper[D]; // neighbouring ranks along each axis
+    float periodicity;
+    bool routed = false; // all particles have been sent to their subdomain once
+
+    // a migrating particle is sent as its global index then its position and rotation; halo copies only carry the position and rotation
+    static constexpr std::size_t ParticleBytes = sizeof(std::uint64_t) + (2 * D - 1) * sizeof(float);
+    static constexpr std::size_t HaloBytes = (2 * D - 1) * sizeof(float);
+    MPI_Datatype particleType, haloType;
+
+    // reused across timesteps
+    std::vector<std::uint8_t> sendLower, sendUpper, receiveLower, receiveUpper;
+
+    // index of the subdomain holding x along axis d, unclamped (i.e. -1 or dims[d] past the edges of the box); clamped for particles within the box
+    inline int rawCoord (float x, int d) const { return int(std::floor((x + periodicity) / (2 * periodicity) * dims[d])); }
+    inline int coordOf (float x, int d) const {
+        int c = rawCoord(x, d);
+        return c < 0 ? 0 : c >= dims[d] ? dims[d] - 1 : c;
+    }
+
+    // appends particle i of store to buffer, with its global index if id is given, and its position shifted by offset along axis d
+    void pack (std::vector<std::uint8_t>& buffer, const ParticleStore<D>& store, std::size_t i, const std::uint64_t* id, int d, float offset) const;
+
+    // appends the particles held in buffer to store, and their global indices to ids if given
+    void unpack (const std::vector<std::uint8_t>& buffer, ParticleStore<D>& store, std::vector<std::uint64_t>* ids) const;
+
+    // sends sendUpper to the upper neighbour along axis d while receiving receiveLower from the lower one, then the other way round
+    void shift (int d, MPI_Datatype type, std::size_t recordBytes);
+
+    // sends each particle straight to the process holding its subdomain, wherever it is; used to distribute the initial state
+    void route (ParticleStore<D>& store, std::vector<std::uint64_t>& ids);
+
+    void fail (const char* message) const {
+        std::printf("Process %d: %s\n", rank, message);
+        std::fflush(stdout);
+        MPI_Abort(comm, 1);
+    }
+
+public:
+
+    DomainDecomposition (MPI_Comm world, float periodicity);
+    DomainDecomposition (const DomainDecomposition&)=delete;
+    DomainDecomposition (DomainDecomposition&&)=delete;
+
+    ~DomainDecomposition () {
+        MPI_Type_free(&particleType);
+        MPI_Type_free(&haloType);
+        MPI_Comm_free(&comm);
+    }
+
+    MPI_Comm communicator () const { return comm; }
+    int getRank () const { return rank; }
+    int getProcesses () const { return processes; }
+    int getDims (int d) const { return dims[d]; }
+
+    void migrate (ParticleStore<D>& store, std::vector<std::uint64_t>& ids) override;
+    void addHalo (ParticleStore<D>& store, float radius) override;
+
+};
+
+
+
+template<int D>
+DomainDecomposition<D>::DomainDecomposition (MPI_Comm world, float periodicity) : periodicity(periodicity) {
+    MPI_Comm_size(world, &processes);
+    int periods[D];
+    for (int d = 0; d < D; ++d) {
+        dims[d] = 0;
+        periods[d] = 1;
+    }
+    MPI_Dims_create(processes, D, dims);
+    MPI_Cart_create(world, D, dims, periods, 0, &comm);
+    MPI_Comm_rank(comm, &rank);
+    MPI_Cart_coords(comm, rank, D, coords);
+    for (int d = 0; d < D; ++d) {
+        MPI_Cart_shift(comm, d, 1, &lower[d], &upper[d]);
+    }
+    MPI_Type_contiguous(int(ParticleBytes), MPI_BYTE, &particleType);
+    MPI_Type_commit(&particleType);
+    MPI_Type_contiguous(int(HaloBytes), MPI_BYTE, &haloType);
+    MPI_Type_commit(&haloType);
+}
+
+template<int D>
+void DomainDecomposition<D>::pack (std::vector<std::uint8_t>& buffer, const ParticleStore<D>& store, std::size_t i, const std::uint64_t* id, int d, float offset) const {
+    std::size_t at = buffer.size();
+    buffer.resize(at + (id != nullptr ? ParticleBytes : HaloBytes));
+    std::uint8_t* out = &buffer[at];
+    if (id != nullptr) {
+        std::memcpy(out, id, sizeof(std::uint64_t));
+        out += sizeof(std::uint64_t);
+    }
+    float values[2 * D - 1];
+    for (int k = 0; k < D; ++k) values[k] = store.positions[k][i];
+    for (int k = 0; k < D-1; ++k) values[D + k] = store.rotations[k][i];
+    values[d] += offset;
+    std::memcpy(out, values, sizeof(values));
+}
+
+template<int D>
+void DomainDecomposition<D>::unpack (const std::vector<std::uint8_t>& buffer, ParticleStore<D>& store, std::vector<std::uint64_t>* ids) const {
+    std::size_t recordBytes = ids != nullptr ? ParticleBytes : HaloBytes;
+    std::size_t count = buffer.size() / recordBytes, first = store.size();
+    store.resize(first + count);
+    if (ids != nullptr) ids->resize(first + count);
+    const std::uint8_t* in = buffer.data();
+    for (std::size_t i = first; i < first + count; ++i) {
+        if (ids != nullptr) {
+            std::memcpy(&(*ids)[i], in, sizeof(std::uint64_t));
+            in += sizeof(std::uint64_t);
+        }
+        float values[2 * D - 1];
+        std::memcpy(values, in, sizeof(values));
+        in += sizeof(values);
+        for (int k = 0; k < D; ++k) store.positions[k][i] = values[k];
+        for (int k = 0; k < D-1; ++k) store.rotations[k][i] = values[D + k];
+        store.setFrozen(i, false);
+    }
+}
+
+template<int D>
+void DomainDecomposition<D>::shift (int d, MPI_Datatype type, std::size_t recordBytes) {
+    auto exchange = [this, type, recordBytes](int to, const std::vector<std::uint8_t>& send, int from, std::vector<std::uint8_t>& receive, int tag) {
+        std::uint64_t sendCount = send.size() / recordBytes, receiveCount = 0;
+        MPI_Sendrecv(&sendCount, 1, MPI_UINT64_T, to, tag, &receiveCount, 1, MPI_UINT64_T, from, tag, comm, MPI_STATUS_IGNORE);
+        receive.resize(receiveCount * recordBytes);
+        MPI_Sendrecv(send.data(), int(sendCount), type, to, tag + 1, receive.data(), int(receiveCount), type, from, tag + 1, comm, MPI_STATUS_IGNORE);
+    };
+    exchange(upper[d], sendUpper, lower[d], receiveLower, 0);
+    exchange(lower[d], sendLower, upper[d], receiveUpper, 2);
+}
+
+template<int D>
+void DomainDecomposition<D>::route (ParticleStore<D>& store, std::vector<std::uint64_t>& ids) {
+    std::size_t count = store.size();
+    std::vector<int> destinations(count);
+    std::vector<int> sendCounts(processes, 0), receiveCounts(processes), sendOffsets(processes, 0), receiveOffsets(processes, 0);
+    for (std::size_t i = 0; i < count; ++i) {
+        int c[D];
+        for (int d = 0; d < D; ++d) c[d] = coordOf(store.positions[d][i], d);
+        MPI_Cart_rank(comm, c, &destinations[i]);
+        ++sendCounts[destinations[i]];
+    }
+    for (int p = 1; p < processes; ++p) sendOffsets[p] = sendOffsets[p - 1] + sendCounts[p - 1];
+
+    // pack by destination, keeping the particle order within each
+    std::vector<std::uint8_t> outgoing, record;
+    outgoing.resize(count * ParticleBytes);
+    std::vector<int> fill(sendOffsets);
+    for (std::size_t i = 0; i < count; ++i) {
+        record.clear();
+        pack(record, store, i, &ids[i], 0, 0.0f);
+        std::memcpy(&outgoing[std::size_t(fill[destinations[i]]++) * ParticleBytes], record.data(), ParticleBytes);
+    }
+
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, receiveCounts.data(), 1, MPI_INT, comm);
+    for (int p = 1; p < processes; ++p) receiveOffsets[p] = receiveOffsets[p - 1] + receiveCounts[p - 1];
+    std::vector<std::uint8_t> incoming(std::size_t(receiveOffsets[processes - 1] + receiveCounts[processes - 1]) * ParticleBytes);
+    MPI_Alltoallv(outgoing.data(), sendCounts.data(), sendOffsets.data(), particleType,
+        incoming.data(), receiveCounts.data(), receiveOffsets.data(), particleType, comm);
+
+    store.resize(0);
+    ids.clear();
+    unpack(incoming, store, &ids);
+}
+
+template<int D>
+void DomainDecomposition<D>::migrate (ParticleStore<D>& store, std::vector<std::uint64_t>& ids) {
+    if (!routed) {
+        route(store, ids);
+        routed = true;
+        return;
+    }
+
+    for (int d = 0; d < D; ++d) {
+        if (dims[d] == 1) continue;
+        sendLower.clear();
+        sendUpper.clear();
+        int above = (coords[d] + 1) % dims[d], below = (coords[d] + dims[d] - 1) % dims[d];
+
+        // compact the particles staying here, in order, and pack the others
+        std::size_t kept = 0;
+        for (std::size_t i = 0, count = store.size(); i < count; ++i) {
+            int c = coordOf(store.positions[d][i], d);
+            if (c == coords[d]) {
+                if (kept != i) {
+                    store.setPos(kept, store.pos(i));
+                    store.setRotation(kept, store.rotation(i));
+                    store.setFrozen(kept, store.frozen(i));
+                    ids[kept] = ids[i];
+                }
+                ++kept;
+            } else if (c == above) {
+                pack(sendUpper, store, i, &ids[i], d, 0.0f);
+            } else if (c == below) {
+                pack(sendLower, store, i, &ids[i], d, 0.0f);
+            } else {
+                fail("a particle moved further than a whole subdomain in one timestep, use fewer processes or a larger box!");
+            }
+        }
+        store.resize(kept);
+        ids.resize(kept);
+
+        shift(d, particleType, ParticleBytes);
+        unpack(receiveLower, store, &ids);
+        unpack(receiveUpper, store, &ids);
+    }
+}
+
+template<int D>
+void DomainDecomposition<D>::addHalo (ParticleStore<D>& store, float radius) {
+    for (int d = 0; d < D; ++d) {
+        if (2 * periodicity / dims[d] < radius) {
+            fail("subdomains are narrower than the interaction radius, use fewer processes or a larger box!");
+        }
+
+        // copies crossing the edge of the box are shifted by its size, so that they lie next to the subdomain receiving them
+        float lowerOffset = coords[d] == 0 ? 2 * periodicity : 0.0f;
+        float upperOffset = coords[d] == dims[d] - 1 ? -2 * periodicity : 0.0f;
+        sendLower.clear();
+        sendUpper.clear();
+        for (std::size_t i = 0, count = store.size(); i < count; ++i) {
+            float x = store.positions[d][i];
+            if (rawCoord(x - radius, d) < coords[d]) pack(sendLower, store, i, nullptr, d, lowerOffset);
+            if (rawCoord(x + radius, d) > coords[d]) pack(sendUpper, store, i, nullptr, d, upperOffset);
+        }
+
+        shift(d, haloType, HaloBytes);
+        unpack(receiveLower, store, nullptr);
+        unpack(receiveUpper, store, nullptr);
+    }
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unistd.h>
+#include "Profiler.h"
+
+/// Streams frames to a file from a dedicated writer thread, so that disk I/O overlaps with the simulation
+/// Frames are serialized into a fixed pool of buffers, which are recycled once written: memory use thus stays bounded whatever the number of frames,
+/// and when the disk cannot keep up, acquire() blocks until a buffer is free again (backpressure) rather than queueing more data
+class FrameWriter {
+
+    std::FILE* file = nullptr;
+    std::string path;
+
+    std::vector<std::vector<std::uint8_t>> buffers;
+    std::deque<std::size_t> freeBuffers; // buffers available to the simulation thread
+    std::deque<std::pair<std::size_t, bool>> pending; // buffers submitted and waiting to be written, in order, and whether each holds a frame
+    std::size_t current;                 // buffer last handed out by acquire(), if any
+    bool acquired = false;
+    bool closing = false;
+
+    std::mutex mutex;
+    std::condition_variable bufferFreed, bufferSubmitted;
+    std::thread writer;
+
+    std::size_t framesWritten = 0;
+    std::size_t bytesWritten = 0;
+    std::size_t bytesSubmitted = 0;
+    std::vector<std::uint64_t> frameOffsets; // offset of each frame within the file, recorded on submission
+    double stallSeconds = 0.0; // time spent by the simulation thread waiting on the writer
+
+    void writeLoop ();
+    void start (std::size_t bufferCount);
+
+public:
+
+    /// Opens (truncates) the file at path, using bufferCount buffers; at most bufferCount - 1 frames are waiting on the disk while the next one is filled
+    FrameWriter (const std::string& path, std::size_t bufferCount = 3);
+    /// Reopens the file at path to carry on a previous run, which had written resumeAt bytes holding the frames at frameOffsets; anything after is discarded
+    FrameWriter (const std::string& path, std::size_t bufferCount, std::uint64_t resumeAt, const std::vector<std::uint64_t>& frameOffsets);
+    FrameWriter (const FrameWriter&)=delete;
+    FrameWriter (FrameWriter&&)=delete;
+
+    ~FrameWriter () { close(); }
+
+    /// Returns an empty buffer to serialize the next frame into, waiting for the writer thread to release one if all are in use
+    std::vector<std::uint8_t>& acquire ();
+
+    /// Queues the buffer returned by the last call to acquire() for writing; isFrame is false for other data (e.g. file headers), which is not counted nor indexed
+    void submit (bool isFrame = true);
+
+    /// Waits until all submitted buffers have been written
+    void flush ();
+
+    /// Blocks until the first bytes bytes submitted have been written, then flushes them to the storage device
+    /// May be called from another thread than the simulation's, as long as it returns before close()
+    void syncTo (std::size_t bytes);
+
+    /// Writes all queued frames, then stops the writer thread and closes the file; called by the destructor if not done explicitly
+    void close ();
+
+    std::size_t getFramesWritten () const { return framesWritten; }
+    std::size_t getBytesWritten () const { return bytesWritten; }
+    std::size_t getBytesSubmitted () const { return bytesSubmitted; }
+    double getStallSeconds () const { return stallSeconds; }
+    const std::vector<std::uint64_t>& getFrameOffsets () const { return frameOffsets; } // includes frames submitted but not yet written
+
+};
+
+
+
+inline FrameWriter::FrameWriter (const std::string& path, std::size_t bufferCount) : path(path) {
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::printf("Could not open output file %s for writing!\n", path.c_str());
+        std::exit(1);
+    }
+    start(bufferCount);
+}
+
+inline FrameWriter::FrameWriter (const std::string& path, std::size_t bufferCount, std::uint64_t resumeAt, const std::vector<std::uint64_t>& frameOffsets) :
+        path(path), framesWritten(frameOffsets.size()), bytesWritten(resumeAt), bytesSubmitted(resumeAt), frameOffsets(frameOffsets) {
+    file = std::fopen(path.c_str(), "r+b");
+    if (file == nullptr) {
+        std::printf("Could not open output file %s to resume writing to it!\n", path.c_str());
+        std::exit(1);
+    }
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    if (size < 0 || std::uint64_t(size) < resumeAt) {
+        std::printf("Output file %s is shorter (%ld bytes) than when the run was interrupted (%lu bytes)!\n", path.c_str(), size, resumeAt);
+        std::exit(1);
+    }
+    if (::ftruncate(::fileno(file), off_t(resumeAt)) != 0 || std::fseek(file, long(resumeAt), SEEK_SET) != 0) {
+        std::printf("Could not truncate output file %s to resume writing to it!\n", path.c_str());
+        std::exit(1);
+    }
+    start(bufferCount);
+}
+
+inline void FrameWriter::start (std::size_t bufferCount) {
+    if (bufferCount < 2) bufferCount = 2;
+    buffers.resize(bufferCount);
+    for (std::size_t b = 0; b < bufferCount; ++b) {
+        freeBuffers.push_back(b);
+    }
+    writer = std::thread(&FrameWriter::writeLoop, this);
+}
+
+inline std::vector<std::uint8_t>& FrameWriter::acquire () {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (acquired) {
+        // previous buffer was never submitted: hand it out again rather than leaking it from the pool
+        buffers[current].clear();
+        return buffers[current];
+    }
+    if (freeBuffers.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        bufferFreed.wait(lock, [this]() { return !freeBuffers.empty(); });
+        stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    current = freeBuffers.front();
+    freeBuffers.pop_front();
+    acquired = true;
+    buffers[current].clear(); // keeps its capacity, so that steady-state frames do not reallocate
+    return buffers[current];
+}
+
+inline void FrameWriter::submit (bool isFrame) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!acquired) return;
+        pending.push_back({ current, isFrame });
+        acquired = false;
+        if (isFrame) frameOffsets.push_back(bytesSubmitted);
+        bytesSubmitted += buffers[current].size();
+    }
+    bufferSubmitted.notify_one();
+}
+
+inline void FrameWriter::flush () {
+    std::unique_lock<std::mutex> lock(mutex);
+    bufferFreed.wait(lock, [this]() { return freeBuffers.size() + (acquired ? 1 : 0) == buffers.size(); });
+}
+
+inline void FrameWriter::syncTo (std::size_t bytes) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        bufferFreed.wait(lock, [this, bytes]() { return bytesWritten >= bytes; });
+    }
+    // writes are flushed from the stream after each buffer, so only the kernel's copy needs to reach the device
+    if (::fsync(::fileno(file)) != 0) {
+        std::printf("Error syncing output file %s to disk!\n", path.c_str());
+        std::exit(1);
+    }
+}
+
+inline void FrameWriter::close () {
+    if (file == nullptr) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    bufferSubmitted.notify_one();
+    writer.join();
+    std::fclose(file);
+    file = nullptr;
+    buffers.clear();
+}
+
+inline void FrameWriter::writeLoop () {
+    if (Profiler::enabled()) Profiler::nameThread("frame writer");
+    while (true) {
+        std::size_t b;
+        bool isFrame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            bufferSubmitted.wait(lock, [this]() { return !pending.empty() || closing; });
+            if (pending.empty()) break; // closing, and everything has been written
+            b = pending.front().first;
+            isFrame = pending.front().second;
+            pending.pop_front();
+        }
+
+        // the buffer is owned by this thread until it is put back on the free list, so the write happens outside the lock
+        const std::vector<std::uint8_t>& data = buffers[b];
+        PROFILE_SCOPE("write frame");
+        if (std::fwrite(data.data(), 1, data.size(), file) != data.size() || std::fflush(file) != 0) {
+            std::printf("Error writing to output file %s!\n", path.c_str());
+            std::exit(1);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (isFrame) ++framesWritten;
+            bytesWritten += data.size();
+            freeBuffers.push_back(b);
+        }
+        bufferFreed.notify_all(); // both the simulation thread and syncTo() may be waiting
+    }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include "Vec.h"
+
+/// Sums over particles from which the online observables of a timestep are derived
+/// Models accumulate them per thread within their update pass (see Model::advance), then add up the partial sums of all threads
+struct ObservableSums {
+    std::uint64_t count = 0;
+    std::uint64_t frozen = 0;
+    double displacement2 = 0;  // squared displacements from the initial positions, unwrapped across periodic boundaries
+    double direction[3] = { }; // unit direction vectors
+    double alignment[6] = { }; // products of direction components: xx, xy, xz, yy, yz, zz (xx, xy, yy in 2D)
+
+    template<int D>
+    inline void add (const Vec<D>& displacement, const Vec<D>& dir, bool isFrozen) {
+        ++count;
+        frozen += isFrozen ? 1 : 0;
+        displacement2 += displacement.lengthSqr();
+        for (int d = 0, k = 0; d < D; ++d) {
+            direction[d] += dir[d];
+            for (int e = d; e < D; ++e) alignment[k++] += dir[d] * dir[e];
+        }
+    }
+
+    void add (const ObservableSums& other) {
+        count += other.count;
+        frozen += other.frozen;
+        displacement2 += other.displacement2;
+        for (int d = 0; d < 3; ++d) direction[d] += other.direction[d];
+        for (int k = 0; k < 6; ++k) alignment[k] += other.alignment[k];
+    }
+};
+
+/// Observables of the particles of a model at a given timestep
+struct ObservableSample {
+    std::uint64_t step = 0;
+    std::uint64_t particles = 0;
+    double msd = 0;     // mean squared displacement from the initial positions, unwrapped across periodic boundaries
+    double polar = 0;   // polar order parameter, i.e. length of the mean direction: 1 when all particles head the same way, ~0 when disordered
+    double nematic = 0; // nematic order parameter, i.e. largest eigenvalue of the Q tensor: 1 when all particles are aligned along one axis, either way
+    double frozen = 0;  // fraction of frozen particles (absorbed by, or escaped through, the boundary)
+
+    template<int D>
+    static ObservableSample from (std::uint64_t step, const ObservableSums& sums);
+};
+
+/// Time series of observables, written as CSV as the run goes, one row per sampled timestep
+class ObservableWriter {
+
+    std::FILE* file = nullptr;
+
+public:
+
+    /// Creates the file at path; when resuming from the given step, the rows of the interrupted run up to that step are kept, and the others dropped
+    ObservableWriter (const std::string& path, std::uint64_t resumeStep);
+    ObservableWriter (const ObservableWriter&)=delete;
+    ObservableWriter (ObservableWriter&&)=delete;
+
+    ~ObservableWriter () {
+        if (file != nullptr) std::fclose(file);
+    }
+
+    void write (const ObservableSample& sample) {
+        std::fprintf(file, "%lu,%lu,%.9g,%.9g,%.9g,%.9g\n", sample.step, sample.particles, sample.msd, sample.polar, sample.nematic, sample.frozen);
+    }
+
+    /// Hands the rows written so far to the system; called on the simulation thread when taking a checkpoint, so that they are not lost if the run is
+    /// killed afterwards
+    void flush () {
+        std::fflush(file);
+    }
+
+    /// Waits for the rows flushed so far to reach the storage device; may be called from another thread (see CheckpointWriter::submit)
+    void sync () {
+        ::fsync(::fileno(file));
+    }
+
+};
+
+
+
+template<int D>
+ObservableSample ObservableSample::from (std::uint64_t step, const ObservableSums& sums) {
+    ObservableSample sample;
+    sample.step = step;
+    sample.particles = sums.count;
+    if (sums.count == 0) return sample;
+    double n = double(sums.count);
+    sample.msd = sums.displacement2 / n;
+    sample.frozen = sums.frozen / n;
+    double polar2 = 0;
+    for (int d = 0; d < D; ++d) polar2 += (sums.direction[d] / n) * (sums.direction[d] / n);
+    sample.polar = std::sqrt(polar2);
+
+    if (D == 2) {
+        // Q = 2 <u u> - I, traceless, with eigenvalues +-sqrt(a^2 + b^2)
+        double a = 2 * sums.alignment[0] / n - 1, b = 2 * sums.alignment[1] / n;
+        sample.nematic = std::sqrt(a * a + b * b);
+    } else {
+        // Q = 3/2 <u u> - 1/2 I; largest eigenvalue of a symmetric 3x3 matrix, in closed form (trigonometric solution of its characteristic polynomial)
+        double xx = 1.5 * sums.alignment[0] / n - 0.5, xy = 1.5 * sums.alignment[1] / n, xz = 1.5 * sums.alignment[2] / n;
+        double yy = 1.5 * sums.alignment[3] / n - 0.5, yz = 1.5 * sums.alignment[4] / n, zz = 1.5 * sums.alignment[5] / n - 0.5;
+        double offDiagonal = xy * xy + xz * xz + yz * yz;
+        double q = (xx + yy + zz) / 3;
+        double p = std::sqrt(((xx - q) * (xx - q) + (yy - q) * (yy - q) + (zz - q) * (zz - q) + 2 * offDiagonal) / 6);
+        if (p < 1e-12) {
+            sample.nematic = q;
+        } else {
+            double bxx = (xx - q) / p, byy = (yy - q) / p, bzz = (zz - q) / p, bxy = xy / p, bxz = xz / p, byz = yz / p;
+            double r = (bxx * (byy * bzz - byz * byz) - bxy * (bxy * bzz - byz * bxz) + bxz * (bxy * byz - byy * bxz)) / 2;
+            double phi = std::acos(std::min(1.0, std::max(-1.0, r))) / 3;
+            sample.nematic = q + 2 * p * std::cos(phi);
+        }
+    }
+    return sample;
+}
+
+inline ObservableWriter::ObservableWriter (const std::string& path, std::uint64_t resumeStep) {
+    std::vector<std::string> previous;
+    if (resumeStep > 0) {
+        file = std::fopen(path.c_str(), "r");
+        if (file != nullptr) {
+            char line[256];
+            while (std::fgets(line, sizeof(line), file) != nullptr) {
+                unsigned long rowStep;
+                if (std::sscanf(line, "%lu,", &rowStep) == 1 && rowStep <= resumeStep) previous.push_back(line);
+            }
+            std::fclose(file);
+        }
+    }
+
+    file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::printf("Could not open %s for writing!\n", path.c_str());
+        std::exit(1);
+    }
+    std::fprintf(file, "step,particles,msd,polar_order,nematic_order,frozen_fraction\n");
+    for (const std::string& row : previous) std::fputs(row.c_str(), file);
+}
@@ -0,0 +1,511 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <type_traits>
+#include "Vec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define AMM_X86 1
+    #include <immintrin.h>
+#endif
+
+/// Inputs shared by all candidates of a single neighbour query
+/// Positions are read as P: either float, or fixed point spanning the periodic domain (std::int32_t or std::int16_t, see PairKernels::toFixed), in which
+/// case directions are read as 16-bit fixed point too; displacements are then computed in integers, wrap around the domain through integer overflow,
+/// and only then converted to float
+template<int D, typename P = float>
+struct PairQuery {
+    typedef typename std::conditional<std::is_same<P, float>::value, float, std::int16_t>::type Direction;
+    
+    const P* positions[D]; // per-component positions of all particles
+    const Direction* directions[D]; // per-component unit directions of all particles
+    P pos[D]; // position of the querying particle
+    std::uint32_t self; // index of the querying particle, which is never counted as its own neighbour
+    float radius2; // squared radius for the neighbour count, direction and displacement sums
+    float separation2; // squared radius for the separation sum
+    float halfBox; // half the size of the periodic domain, or infinity when not periodic (float positions only)
+    float positionScale = 0; // length of one fixed-point step of the positions (fixed point only)
+    float directionScale = 0; // value of one fixed-point step of the directions (fixed point only)
+};
+
+/// Partial sums held in 16 lanes; candidate k of each slice always goes to lane k % 16 and lanes are only combined in reduce()
+/// Every kernel thus performs exactly the same float operations in the same order, and produces bit-identical results whatever the instruction set
+template<int D>
+struct alignas(64) PairLanes {
+    static constexpr int Width = 16;
+    float count[Width];
+    float direction[D][Width];
+    float displacement[D][Width]; // sum of (pos - neighbour pos), using the nearest periodic image
+    float separation[D][Width]; // same as displacement, but only over neighbours within the separation radius
+
+    void clear () {
+        for (int l = 0; l < Width; ++l) {
+            count[l] = 0.0f;
+            for (int d = 0; d < D; ++d) {
+                direction[d][l] = displacement[d][l] = separation[d][l] = 0.0f;
+            }
+        }
+    }
+};
+
+template<int D>
+struct PairSums {
+    unsigned int count;
+    Vec<D> direction;
+    Vec<D> displacement;
+    Vec<D> separation;
+};
+
+/// Masked pair-interaction kernels, summing the contributions of a list of candidate neighbours
+/// The implementation is picked at runtime from the instruction sets supported by the CPU, so a single binary makes the most of each machine
+class PairKernels {
+    PairKernels()=delete;
+    PairKernels(const PairKernels&)=delete;
+    PairKernels(PairKernels&&)=delete;
+public:
+
+    enum class Isa { Scalar, SSE4, AVX2, AVX512 };
+
+    /// Best instruction set supported by the current CPU
+    static Isa detect () {
+#ifdef AMM_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return Isa::AVX512;
+        if (__builtin_cpu_supports("avx2")) return Isa::AVX2;
+        if (__builtin_cpu_supports("sse4.1")) return Isa::SSE4;
+#endif
+        return Isa::Scalar;
+    }
+
+    static Isa& selected () {
+        static Isa isa = detect();
+        return isa;
+    }
+
+    static const char* name (Isa isa) {
+        switch (isa) {
+            case Isa::SSE4: return "sse4";
+            case Isa::AVX2: return "avx2";
+            case Isa::AVX512: return "avx512";
+            default: return "scalar";
+        }
+    }
+
+    /// Selects kernels by name ("auto", "scalar", "sse4", "avx2" or "avx512"); returns false for unknown names or instruction sets the CPU does not support
+    static bool select (const std::string& which) {
+        if (which.compare("auto") == 0) {
+            selected() = detect();
+            return true;
+        }
+        for (Isa isa : { Isa::Scalar, Isa::SSE4, Isa::AVX2, Isa::AVX512 }) {
+            if (which.compare(name(isa)) == 0) {
+                if (isa > detect()) return false;
+                selected() = isa;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Fixed-point coordinate of x within the periodic domain [-halfBox, halfBox), spanning the whole range of P (std::int32_t or std::int16_t)
+    template<typename P>
+    static inline P toFixed (float x, float halfBox) {
+        typedef typename std::make_unsigned<P>::type U;
+        const double steps = double(U(-1)) + 1.0;
+        return P(U(std::llrint(double(x) * (steps / (2.0 * halfBox))))); // halfBox itself wraps around to -halfBox
+    }
+    
+    /// Length of one step of toFixed
+    template<typename P>
+    static inline float fixedStep (float halfBox) {
+        typedef typename std::make_unsigned<P>::type U;
+        return float(2.0 * halfBox / (double(U(-1)) + 1.0));
+    }
+    
+    /// 16-bit fixed-point component of a unit direction, and the value of one step
+    static constexpr float DirectionStep = 1.0f / 32767.0f;
+    static inline std::int16_t directionToFixed (float u) {
+        return std::int16_t(std::lrint(u * 32767.0f));
+    }
+
+    /// Adds the contributions of the n candidates listed in indices to lanes; when Full is false, only the count and direction sums are computed
+    template<int D, bool Full, typename P>
+    static void accumulate (const PairQuery<D, P>& q, const std::uint32_t* indices, std::size_t n, PairLanes<D>& lanes) {
+        switch (selected()) {
+#ifdef AMM_X86
+            case Isa::AVX512: avx512<D, Full, P>(q, indices, n, lanes); break;
+            case Isa::AVX2: avx2<D, Full, P>(q, indices, n, lanes); break;
+            case Isa::SSE4: sse4<D, Full, P>(q, indices, n, lanes); break;
+#endif
+            default: scalar<D, Full, P>(q, indices, n, lanes); break;
+        }
+    }
+
+    /// Combines the lanes, in a fixed order
+    template<int D>
+    static PairSums<D> reduce (const PairLanes<D>& lanes) {
+        PairSums<D> sums;
+        float count = 0.0f;
+        for (int l = 0; l < PairLanes<D>::Width; ++l) count += lanes.count[l];
+        sums.count = (unsigned int)count;
+        for (int d = 0; d < D; ++d) {
+            float dir = 0.0f, disp = 0.0f, sep = 0.0f;
+            for (int l = 0; l < PairLanes<D>::Width; ++l) {
+                dir += lanes.direction[d][l];
+                disp += lanes.displacement[d][l];
+                sep += lanes.separation[d][l];
+            }
+            sums.direction.set(d, dir);
+            sums.displacement.set(d, disp);
+            sums.separation.set(d, sep);
+        }
+        return sums;
+    }
+
+private:
+
+    static constexpr int W = 16;
+
+    // copies the next chunk of candidate indices, padding past the end of the list with the querying particle's own index (which is always masked out)
+    static inline void loadChunk (std::uint32_t* chunk, const std::uint32_t* indices, std::size_t k, std::size_t n, std::uint32_t self) {
+        for (int l = 0; l < W; ++l) {
+            chunk[l] = k + l < n ? indices[k + l] : self;
+        }
+    }
+
+    // difference a - b between fixed-point values, wrapping around the range of P
+    template<typename P>
+    static inline std::int32_t fixedDifference (P a, P b) {
+        typedef typename std::make_unsigned<P>::type U;
+        return std::int32_t(P(U(U(a) - U(b))));
+    }
+
+    template<int D, bool Full, typename P>
+    static void scalar (const PairQuery<D, P>& q, const std::uint32_t* indices, std::size_t n, PairLanes<D>& lanes);
+
+#ifdef AMM_X86
+    // fixed-point values widened to 32-bit lanes: 16-bit values are read as the low half of a 32-bit word (so arrays of them need one element of
+    // padding), then sign-extended, which also wraps differences of 16-bit values around their range
+    __attribute__((target("avx2"))) static inline __m256i widen256 (__m256i v) {
+        return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+    }
+    template<typename T>
+    __attribute__((target("avx2"))) static inline __m256i gatherFixed256 (__m256i indices, const T* base) {
+        if constexpr (sizeof(T) == 4) {
+            return _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), indices, 4);
+        } else {
+            return widen256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(base), indices, 2));
+        }
+    }
+
+    template<int D, bool Full, typename P>
+    __attribute__((target("sse4.1"))) static void sse4 (const PairQuery<D, P>& q, const std::uint32_t* indices, std::size_t n, PairLanes<D>& lanes);
+
+    template<int D, bool Full, typename P>
+    __attribute__((target("avx2"))) static void avx2 (const PairQuery<D, P>& q, const std::uint32_t* indices, std::size_t n, PairLanes<D>& lanes);
+
+    // masked forms of the gathers, shifts and conversion, as the unmasked ones trip -Wmaybe-uninitialized in GCC's own headers
+    __attribute__((target("avx512f"))) static inline __m512 gather512 (__m512i indices, const float* base) {
+        return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), __mmask16(0xFFFF), indices, base, 4);
+    }
+    __attribute__((target("avx512f"))) static inline __m512i widen512 (__m512i v) {
+        return _mm512_maskz_srai_epi32(__mmask16(0xFFFF), _mm512_maskz_slli_epi32(__mmask16(0xFFFF), v, 16), 16);
+    }
+    __attribute__((target("avx512f"))) static inline __m512 toFloat512 (__m512i v) {
+        return _mm512_maskz_cvtepi32_ps(__mmask16(0xFFFF), v);
+    }
+    template<typename T>
+    __attribute__((target("avx512f"))) static inline __m512i gatherFixed512 (__m512i indices, const T* base) {
+        if constexpr (sizeof(T) == 4) {
+            return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), __mmask16(0xFFFF), indices, base, 4);
+        } else {
+            return widen512(_mm512_mask_i32gather_epi32(_mm512_setzero_si512(), __mmask16(0xFFFF), indices, base, 2));
+        }
+    }
+
+    template<int D, bool Full, typename P>
+    __attribute__((target("avx512f"))) static void avx512 (const PairQuery<D, P>& q, const std::uint32_t* indices, std::size_t n, PairLanes<D>& lanes);
+#endif
+
+};
+
+
+
+// Note: bit-identical results across kernels rely on no multiply-add contraction taking place, hence -ffp-contract=off in the makefile
+
+template<int D, bool Full, typename P>
+void PairKernels::scalar (const PairQuery<D, P>& q, const std::uint32_t* indices, std::size_t n, PairLanes<D>& lanes) {
+    const float L = q.halfBox, L2 = 2 * q.halfBox;
+    std::uint32_t chunk[W];
+    for (std::size_t k = 0; k < n; k += W) {
+        loadChunk(chunk, indices, k, n, q.self);
+        for (int l = 0; l < W; ++l) {
+            std::uint32_t j = chunk[l];
+            if (j == q.self) continue;
+
+            float delta[D];
+            for (int d = 0; d < D; ++d) {
+                if constexpr (std::is_same<P, float>::value) {
+                    float v = q.pos[d] - q.positions[d][j];
+                    delta[d] = v > L ? v - L2 : v < -L ? v + L2 : v;
+                } else {
+                    delta[d] = float(fixedDifference(q.pos[d], q.positions[d][j])) * q.positionScale;
+                }
+            }
+            float d2 = delta[0] * delta[0];
+            for (int d = 1; d < D; ++d) d2 = d2 + delta[d] * delta[d];
+
+            if (d2 <= q.radius2) {
+                lanes.count[l] = lanes.count[l] + 1.0f;
+                for (int d = 0; d < D; ++d) {
+                    if constexpr (std::is_same<P, float>::value) {
+                        lanes.direction[d][l] = lanes.direction[d][l] + q.directions[d][j];
+                    } else {
+                        lanes.direction[d][l] = lanes.direction[d][l] + float(q.directions[d][j]) * q.directionScale;
+                    }
+                    if (Full) lanes.displacement[d][l] = lanes.displacement[d][l] + delta[d];
+                }
+            }
+            if (Full && d2 <= q.separation2) {
+                for (int d = 0; d < D; ++d) {
+                    lanes.separation[d][l] = lanes.separation[d][l] + delta[d];
+                }
+            }
+        }
+    }
+}
+
+#ifdef AMM_X86
+
+template<int D, bool Full, typename P>
+void PairKernels::sse4 (const PairQuery<D, P>& q, const std::uint32_t* indices, std::size_t n, PairLanes<D>& lanes) {
+    constexpr int V = 4, H = W / V;
+    const __m128 L = _mm_set1_ps(q.halfBox), negL = _mm_set1_ps(-q.halfBox), L2 = _mm_set1_ps(2 * q.halfBox);
+    const __m128 r2 = _mm_set1_ps(q.radius2), s2 = _mm_set1_ps(q.separation2), one = _mm_set1_ps(1.0f);
+    const __m128i self = _mm_set1_epi32(int(q.self)), allSet = _mm_set1_epi32(-1);
+    const __m128 positionScale = _mm_set1_ps(q.positionScale), directionScale = _mm_set1_ps(q.directionScale);
+    __m128 p[D];
+    __m128i fixedP[D];
+    for (int d = 0; d < D; ++d) {
+        if constexpr (std::is_same<P, float>::value) p[d] = _mm_set1_ps(q.pos[d]);
+        else fixedP[d] = _mm_set1_epi32(q.pos[d]);
+    }
+
+    __m128 count[H], dir[D][H], disp[D][H], sep[D][H];
+    for (int h = 0; h < H; ++h) {
+        count[h] = _mm_load_ps(lanes.count + V*h);
+        for (int d = 0; d < D; ++d) {
+            dir[d][h] = _mm_load_ps(lanes.direction[d] + V*h);
+            disp[d][h] = _mm_load_ps(lanes.displacement[d] + V*h);
+            sep[d][h] = _mm_load_ps(lanes.separation[d] + V*h);
+        }
+    }
+
+    alignas(64) std::uint32_t chunk[W];
+    for (std::size_t k = 0; k < n; k += W) {
+        loadChunk(chunk, indices, k, n, q.self);
+        for (int h = 0; h < H; ++h) {
+            const std::uint32_t* c = chunk + V*h;
+            __m128i j = _mm_load_si128((const __m128i*)c);
+            __m128 valid = _mm_castsi128_ps(_mm_xor_si128(_mm_cmpeq_epi32(j, self), allSet));
+
+            __m128 delta[D];
+            for (int d = 0; d < D; ++d) {
+                const P* x = q.positions[d];
+                if constexpr (std::is_same<P, float>::value) {
+                    __m128 v = _mm_sub_ps(p[d], _mm_setr_ps(x[c[0]], x[c[1]], x[c[2]], x[c[3]]));
+                    __m128 hi = _mm_cmpgt_ps(v, L), lo = _mm_cmplt_ps(v, negL);
+                    v = _mm_blendv_ps(v, _mm_sub_ps(v, L2), hi);
+                    delta[d] = _mm_blendv_ps(v, _mm_add_ps(v, L2), lo);
+                } else {
+                    __m128i v = _mm_sub_epi32(fixedP[d], _mm_setr_epi32(x[c[0]], x[c[1]], x[c[2]], x[c[3]]));
+                    if constexpr (sizeof(P) == 2) v = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+                    delta[d] = _mm_mul_ps(_mm_cvtepi32_ps(v), positionScale);
+                }
+            }
+            __m128 d2 = _mm_mul_ps(delta[0], delta[0]);
+            for (int d = 1; d < D; ++d) d2 = _mm_add_ps(d2, _mm_mul_ps(delta[d], delta[d]));
+
+            __m128 in = _mm_and_ps(valid, _mm_cmple_ps(d2, r2));
+            count[h] = _mm_blendv_ps(count[h], _mm_add_ps(count[h], one), in);
+            for (int d = 0; d < D; ++d) {
+                const typename PairQuery<D, P>::Direction* u = q.directions[d];
+                __m128 ud;
+                if constexpr (std::is_same<P, float>::value) {
+                    ud = _mm_setr_ps(u[c[0]], u[c[1]], u[c[2]], u[c[3]]);
+                } else {
+                    ud = _mm_mul_ps(_mm_cvtepi32_ps(_mm_setr_epi32(u[c[0]], u[c[1]], u[c[2]], u[c[3]])), directionScale);
+                }
+                dir[d][h] = _mm_blendv_ps(dir[d][h], _mm_add_ps(dir[d][h], ud), in);
+                if (Full) disp[d][h] = _mm_blendv_ps(disp[d][h], _mm_add_ps(disp[d][h], delta[d]), in);
+            }
+            if (Full) {
+                __m128 inSep = _mm_and_ps(valid, _mm_cmple_ps(d2, s2));
+                for (int d = 0; d < D; ++d) {
+                    sep[d][h] = _mm_blendv_ps(sep[d][h], _mm_add_ps(sep[d][h], delta[d]), inSep);
+                }
+            }
+        }
+    }
+
+    for (int h = 0; h < H; ++h) {
+        _mm_store_ps(lanes.count + V*h, count[h]);
+        for (int d = 0; d < D; ++d) {
+            _mm_store_ps(lanes.direction[d] + V*h, dir[d][h]);
+            _mm_store_ps(lanes.displacement[d] + V*h, disp[d][h]);
+            _mm_store_ps(lanes.separation[d] + V*h, sep[d][h]);
+        }
+    }
+}
+
+template<int D, bool Full, typename P>
+void PairKernels::avx2 (const PairQuery<D, P>& q, const std::uint32_t* indices, std::size_t n, PairLanes<D>& lanes) {
+    constexpr int V = 8, H = W / V;
+    const __m256 L = _mm256_set1_ps(q.halfBox), negL = _mm256_set1_ps(-q.halfBox), L2 = _mm256_set1_ps(2 * q.halfBox);
+    const __m256 r2 = _mm256_set1_ps(q.radius2), s2 = _mm256_set1_ps(q.separation2), one = _mm256_set1_ps(1.0f);
+    const __m256i self = _mm256_set1_epi32(int(q.self)), allSet = _mm256_set1_epi32(-1);
+    const __m256 positionScale = _mm256_set1_ps(q.positionScale), directionScale = _mm256_set1_ps(q.directionScale);
+    __m256 p[D];
+    __m256i fixedP[D];
+    for (int d = 0; d < D; ++d) {
+        if constexpr (std::is_same<P, float>::value) p[d] = _mm256_set1_ps(q.pos[d]);
+        else fixedP[d] = _mm256_set1_epi32(q.pos[d]);
+    }
+
+    __m256 count[H], dir[D][H], disp[D][H], sep[D][H];
+    for (int h = 0; h < H; ++h) {
+        count[h] = _mm256_load_ps(lanes.count + V*h);
+        for (int d = 0; d < D; ++d) {
+            dir[d][h] = _mm256_load_ps(lanes.direction[d] + V*h);
+            disp[d][h] = _mm256_load_ps(lanes.displacement[d] + V*h);
+            sep[d][h] = _mm256_load_ps(lanes.separation[d] + V*h);
+        }
+    }
+
+    alignas(64) std::uint32_t chunk[W];
+    for (std::size_t k = 0; k < n; k += W) {
+        loadChunk(chunk, indices, k, n, q.self);
+        for (int h = 0; h < H; ++h) {
+            __m256i j = _mm256_load_si256((const __m256i*)(chunk + V*h));
+            __m256 valid = _mm256_castsi256_ps(_mm256_xor_si256(_mm256_cmpeq_epi32(j, self), allSet));
+
+            __m256 delta[D];
+            for (int d = 0; d < D; ++d) {
+                if constexpr (std::is_same<P, float>::value) {
+                    __m256 v = _mm256_sub_ps(p[d], _mm256_i32gather_ps(q.positions[d], j, 4));
+                    __m256 hi = _mm256_cmp_ps(v, L, _CMP_GT_OQ), lo = _mm256_cmp_ps(v, negL, _CMP_LT_OQ);
+                    v = _mm256_blendv_ps(v, _mm256_sub_ps(v, L2), hi);
+                    delta[d] = _mm256_blendv_ps(v, _mm256_add_ps(v, L2), lo);
+                } else {
+                    __m256i v = _mm256_sub_epi32(fixedP[d], gatherFixed256(j, q.positions[d]));
+                    if constexpr (sizeof(P) == 2) v = widen256(v);
+                    delta[d] = _mm256_mul_ps(_mm256_cvtepi32_ps(v), positionScale);
+                }
+            }
+            __m256 d2 = _mm256_mul_ps(delta[0], delta[0]);
+            for (int d = 1; d < D; ++d) d2 = _mm256_add_ps(d2, _mm256_mul_ps(delta[d], delta[d]));
+
+            __m256 in = _mm256_and_ps(valid, _mm256_cmp_ps(d2, r2, _CMP_LE_OQ));
+            count[h] = _mm256_blendv_ps(count[h], _mm256_add_ps(count[h], one), in);
+            for (int d = 0; d < D; ++d) {
+                __m256 u;
+                if constexpr (std::is_same<P, float>::value) {
+                    u = _mm256_i32gather_ps(q.directions[d], j, 4);
+                } else {
+                    u = _mm256_mul_ps(_mm256_cvtepi32_ps(gatherFixed256(j, q.directions[d])), directionScale);
+                }
+                dir[d][h] = _mm256_blendv_ps(dir[d][h], _mm256_add_ps(dir[d][h], u), in);
+                if (Full) disp[d][h] = _mm256_blendv_ps(disp[d][h], _mm256_add_ps(disp[d][h], delta[d]), in);
+            }
+            if (Full) {
+                __m256 inSep = _mm256_and_ps(valid, _mm256_cmp_ps(d2, s2, _CMP_LE_OQ));
+                for (int d = 0; d < D; ++d) {
+                    sep[d][h] = _mm256_blendv_ps(sep[d][h], _mm256_add_ps(sep[d][h], delta[d]), inSep);
+                }
+            }
+        }
+    }
+
+    for (int h = 0; h < H; ++h) {
+        _mm256_store_ps(lanes.count + V*h, count[h]);
+        for (int d = 0; d < D; ++d) {
+            _mm256_store_ps(lanes.direction[d] + V*h, dir[d][h]);
+            _mm256_store_ps(lanes.displacement[d] + V*h, disp[d][h]);
+            _mm256_store_ps(lanes.separation[d] + V*h, sep[d][h]);
+        }
+    }
+}
+
+template<int D, bool Full, typename P>
+void PairKernels::avx512 (const PairQuery<D, P>& q, const std::uint32_t* indices, std::size_t n, PairLanes<D>& lanes) {
+    const __m512 L = _mm512_set1_ps(q.halfBox), negL = _mm512_set1_ps(-q.halfBox), L2 = _mm512_set1_ps(2 * q.halfBox);
+    const __m512 r2 = _mm512_set1_ps(q.radius2), s2 = _mm512_set1_ps(q.separation2), one = _mm512_set1_ps(1.0f);
+    const __m512i self = _mm512_set1_epi32(int(q.self));
+    const __m512 positionScale = _mm512_set1_ps(q.positionScale), directionScale = _mm512_set1_ps(q.directionScale);
+    __m512 p[D];
+    __m512i fixedP[D];
+    for (int d = 0; d < D; ++d) {
+        if constexpr (std::is_same<P, float>::value) p[d] = _mm512_set1_ps(q.pos[d]);
+        else fixedP[d] = _mm512_set1_epi32(q.pos[d]);
+    }
+
+    __m512 count = _mm512_load_ps(lanes.count), dir[D], disp[D], sep[D];
+    for (int d = 0; d < D; ++d) {
+        dir[d] = _mm512_load_ps(lanes.direction[d]);
+        disp[d] = _mm512_load_ps(lanes.displacement[d]);
+        sep[d] = _mm512_load_ps(lanes.separation[d]);
+    }
+
+    alignas(64) std::uint32_t chunk[W];
+    for (std::size_t k = 0; k < n; k += W) {
+        loadChunk(chunk, indices, k, n, q.self);
+        __m512i j = _mm512_load_si512(chunk);
+        __mmask16 valid = _mm512_cmpneq_epi32_mask(j, self);
+
+        __m512 delta[D];
+        for (int d = 0; d < D; ++d) {
+            if constexpr (std::is_same<P, float>::value) {
+                __m512 v = _mm512_sub_ps(p[d], gather512(j, q.positions[d]));
+                __mmask16 hi = _mm512_cmp_ps_mask(v, L, _CMP_GT_OQ), lo = _mm512_cmp_ps_mask(v, negL, _CMP_LT_OQ);
+                v = _mm512_mask_sub_ps(v, hi, v, L2);
+                delta[d] = _mm512_mask_add_ps(v, lo, v, L2);
+            } else {
+                __m512i v = _mm512_sub_epi32(fixedP[d], gatherFixed512(j, q.positions[d]));
+                if constexpr (sizeof(P) == 2) v = widen512(v);
+                delta[d] = _mm512_mul_ps(toFloat512(v), positionScale);
+            }
+        }
+        __m512 d2 = _mm512_mul_ps(delta[0], delta[0]);
+        for (int d = 1; d < D; ++d) d2 = _mm512_add_ps(d2, _mm512_mul_ps(delta[d], delta[d]));
+
+        __mmask16 in = valid & _mm512_cmp_ps_mask(d2, r2, _CMP_LE_OQ);
+        count = _mm512_mask_add_ps(count, in, count, one);
+        for (int d = 0; d < D; ++d) {
+            __m512 u;
+            if constexpr (std::is_same<P, float>::value) {
+                u = gather512(j, q.directions[d]);
+            } else {
+                u = _mm512_mul_ps(toFloat512(gatherFixed512(j, q.directions[d])), directionScale);
+            }
+            dir[d] = _mm512_mask_add_ps(dir[d], in, dir[d], u);
+            if (Full) disp[d] = _mm512_mask_add_ps(disp[d], in, disp[d], delta[d]);
+        }
+        if (Full) {
+            __mmask16 inSep = valid & _mm512_cmp_ps_mask(d2, s2, _CMP_LE_OQ);
+            for (int d = 0; d < D; ++d) {
+                sep[d] = _mm512_mask_add_ps(sep[d], inSep, sep[d], delta[d]);
+            }
+        }
+    }
+
+    _mm512_store_ps(lanes.count, count);
+    for (int d = 0; d < D; ++d) {
+        _mm512_store_ps(lanes.direction[d], dir[d]);
+        _mm512_store_ps(lanes.displacement[d], disp[d]);
+        _mm512_store_ps(lanes.separation[d], sep[d]);
+    }
+}
+
+#endif
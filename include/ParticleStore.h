@@ -0,0 +1,197 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <new>
+#include "Vec.h"
+#include "VecUtils.h"
+#include "BinaryIO.h"
+
+/// Allocator returning memory aligned to Alignment bytes (a cache line by default), so that arrays may be streamed through vector registers
+template<typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    typedef T value_type;
+    template<typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator () { }
+    template<typename U> AlignedAllocator (const AlignedAllocator<U, Alignment>&) { }
+
+    T* allocate (std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate (T* ptr, std::size_t) {
+        ::operator delete(ptr, std::align_val_t(Alignment));
+    }
+
+    template<typename U> bool operator== (const AlignedAllocator<U, Alignment>&) const { return true; }
+    template<typename U> bool operator!= (const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+
+template<int D> class ParticleStore;
+
+/// How particle orientations are stored: as angles (see VecUtils::toSpherical), or as unit direction vectors, which spares models the trigonometry of
+/// converting between the two at every timestep; the other representation is then only derived when needed, i.e. for I/O
+enum class Orientation : std::uint8_t {
+    Angles,
+    Vectors
+};
+
+/// Handle onto a single particle of a ParticleStore, gathering and scattering its fields from and to the separate arrays
+template<int D>
+class ParticleView {
+
+    ParticleStore<D>* store;
+    std::size_t i;
+
+public:
+
+    ParticleView (ParticleStore<D>* store, std::size_t i) : store(store), i(i) { }
+
+    inline std::size_t index () const { return i; }
+
+    inline Vec<D> pos () const { return store->pos(i); }
+    inline void setPos (const Vec<D>& pos) { store->setPos(i, pos); }
+
+    inline Vec<D-1> rotation () const { return store->rotation(i); } // in 2D, theta; in 3D theta (lat) and phi (long)
+    inline void setRotation (const Vec<D-1>& rotation) { store->setRotation(i, rotation); }
+
+    inline Vec<D> direction () const { return store->direction(i); } // unit vector
+    inline void setDirection (const Vec<D>& direction) { store->setDirection(i, direction); }
+    inline void setOrientation (const Vec<D-1>& rotation, const Vec<D>& direction) { store->setOrientation(i, rotation, direction); }
+
+    inline bool frozen () const { return store->frozen(i); } // frozen particles are not updated
+    inline void setFrozen (bool frozen) { store->setFrozen(i, frozen); }
+
+};
+
+/// Structure-of-arrays particle storage: each position coordinate, each rotation angle (or direction component) and the frozen flag live in their own
+/// contiguous, aligned array
+/// Loops which only need positions thus only stream positions through the cache, and consecutive particles map to consecutive vector lanes
+template<int D>
+class ParticleStore {
+
+    std::size_t count = 0;
+    Orientation orientation = Orientation::Angles;
+
+public:
+
+    AlignedVector<float> positions[D];
+    AlignedVector<float> rotations[D-1]; // empty unless orientations are stored as Orientation::Angles
+    AlignedVector<float> directions[D]; // empty unless orientations are stored as Orientation::Vectors
+    AlignedVector<std::uint8_t> frozenFlags;
+
+    ParticleStore () { }
+    ParticleStore (std::size_t count) { resize(count); }
+
+    /// Selects how orientations are stored, before any particle is
+    void setOrientationStorage (Orientation storage) {
+        orientation = storage;
+        resize(count);
+    }
+    inline Orientation getOrientationStorage () const { return orientation; }
+
+    void resize (std::size_t n) {
+        count = n;
+        for (int d = 0; d < D; ++d) positions[d].resize(n, 0.0f);
+        for (int d = 0; d < D-1; ++d) rotations[d].resize(orientation == Orientation::Angles ? n : 0, 0.0f);
+        for (int d = 0; d < D; ++d) directions[d].resize(orientation == Orientation::Vectors ? n : 0, 0.0f);
+        frozenFlags.resize(n, 0);
+    }
+
+    inline std::size_t size () const { return count; }
+
+    inline ParticleView<D> operator[] (std::size_t i) { return ParticleView<D>(this, i); }
+
+    inline Vec<D> pos (std::size_t i) const {
+        Vec<D> p;
+        for (int d = 0; d < D; ++d) p.set(d, positions[d][i]);
+        return p;
+    }
+    inline void setPos (std::size_t i, const Vec<D>& pos) {
+        for (int d = 0; d < D; ++d) positions[d][i] = pos[d];
+    }
+
+    // orientations may be read and written either way, whichever way they are stored, converting them as needed
+    inline Vec<D-1> rotation (std::size_t i) const {
+        if (orientation == Orientation::Vectors) return VecUtils::toSpherical<D>(direction(i));
+        Vec<D-1> r;
+        for (int d = 0; d < D-1; ++d) r.set(d, rotations[d][i]);
+        return r;
+    }
+    inline void setRotation (std::size_t i, const Vec<D-1>& rotation) {
+        if (orientation == Orientation::Vectors) {
+            setDirection(i, VecUtils::toCartesian<D>(rotation));
+        } else {
+            for (int d = 0; d < D-1; ++d) rotations[d][i] = rotation[d];
+        }
+    }
+
+    inline Vec<D> direction (std::size_t i) const {
+        if (orientation == Orientation::Angles) return VecUtils::toCartesian<D>(rotation(i));
+        Vec<D> dir;
+        for (int d = 0; d < D; ++d) dir.set(d, directions[d][i]);
+        return dir;
+    }
+    inline void setDirection (std::size_t i, const Vec<D>& direction) {
+        if (orientation == Orientation::Angles) {
+            setRotation(i, VecUtils::toSpherical<D>(direction));
+        } else {
+            for (int d = 0; d < D; ++d) directions[d][i] = direction[d];
+        }
+    }
+
+    // sets the orientation of particle i when it is already known both ways, storing whichever is used
+    inline void setOrientation (std::size_t i, const Vec<D-1>& rotation, const Vec<D>& direction) {
+        if (orientation == Orientation::Angles) {
+            for (int d = 0; d < D-1; ++d) rotations[d][i] = rotation[d];
+        } else {
+            for (int d = 0; d < D; ++d) directions[d][i] = direction[d];
+        }
+    }
+
+    inline bool frozen (std::size_t i) const { return frozenFlags[i] != 0; }
+    inline void setFrozen (std::size_t i, bool frozen) { frozenFlags[i] = frozen ? 1 : 0; }
+
+    /// Reorders the first order.size() particles so that particle order[j] moves to index j, dropping any others; the arrays are gathered into those
+    /// of scratch, in parallel, then swapped with them
+    void permute (const std::vector<std::uint32_t>& order, ParticleStore<D>& scratch) {
+        std::size_t n = order.size();
+        scratch.orientation = orientation;
+        scratch.resize(n);
+        #pragma omp parallel for
+        for (std::size_t j = 0; j < n; ++j) {
+            std::size_t i = order[j];
+            for (int d = 0; d < D; ++d) scratch.positions[d][j] = positions[d][i];
+            if (orientation == Orientation::Angles) {
+                for (int d = 0; d < D-1; ++d) scratch.rotations[d][j] = rotations[d][i];
+            } else {
+                for (int d = 0; d < D; ++d) scratch.directions[d][j] = directions[d][i];
+            }
+            scratch.frozenFlags[j] = frozenFlags[i];
+        }
+        for (int d = 0; d < D; ++d) positions[d].swap(scratch.positions[d]);
+        for (int d = 0; d < D-1; ++d) rotations[d].swap(scratch.rotations[d]);
+        for (int d = 0; d < D; ++d) directions[d].swap(scratch.directions[d]);
+        frozenFlags.swap(scratch.frozenFlags);
+        count = n;
+    }
+
+    /// Appends all arrays in use to data, as raw bytes; load reads them back into a store of the same size, storing orientations the same way
+    void save (std::vector<std::uint8_t>& data) const {
+        for (int d = 0; d < D; ++d) BinIO::writeArray(data, positions[d].data(), count);
+        for (int d = 0; d < D-1; ++d) BinIO::writeArray(data, rotations[d].data(), rotations[d].size());
+        for (int d = 0; d < D; ++d) BinIO::writeArray(data, directions[d].data(), directions[d].size());
+        BinIO::writeArray(data, frozenFlags.data(), count);
+    }
+    void load (const std::vector<std::uint8_t>& data, std::size_t& at) {
+        for (int d = 0; d < D; ++d) BinIO::readArray(data, at, positions[d].data(), count);
+        for (int d = 0; d < D-1; ++d) BinIO::readArray(data, at, rotations[d].data(), rotations[d].size());
+        for (int d = 0; d < D; ++d) BinIO::readArray(data, at, directions[d].data(), directions[d].size());
+        BinIO::readArray(data, at, frozenFlags.data(), count);
+    }
+
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/// Hardware performance counters of the calling thread, read through Linux perf_event_open
+/// All counters belong to one group, so that the kernel schedules them together and a single read returns them all
+/// Counters are often unavailable (containers, virtual machines without a virtual PMU, perf_event_paranoid > 2): open then fails, or leaves some counters out
+class PerfCounters {
+public:
+
+    enum Counter {
+        Cycles,
+        Instructions,
+        L1Misses,     // L1 data cache read misses
+        LLCMisses,    // last level cache misses, i.e. lines fetched from memory
+        BranchMisses,
+        CounterCount
+    };
+
+    struct Values {
+        std::uint64_t counts[CounterCount] = { };
+    };
+
+    static constexpr std::size_t CacheLineSize = 64;
+
+    static const char* name (Counter counter);
+
+    PerfCounters () { }
+    PerfCounters (const PerfCounters&)=delete;
+    PerfCounters (PerfCounters&&)=delete;
+
+    ~PerfCounters () { close(); }
+
+    /// Starts counting on the calling thread (user space only); returns false, with the reason in error, if no counter could be opened
+    bool open (std::string& error);
+    void close ();
+
+    bool isOpen () const { return fds[Cycles] >= 0; }
+    bool available (Counter counter) const { return fds[counter] >= 0; }
+
+    /// Current counts since open, scaled up if the group was not always scheduled on the PMU; unavailable counters read as 0
+    bool read (Values& values) const;
+
+private:
+
+    int fds[CounterCount] = { -1, -1, -1, -1, -1 };
+    std::size_t slots[CounterCount] = { }; // position of each counter in the values returned by a group read
+
+};
+
+
+
+inline const char* PerfCounters::name (Counter counter) {
+    switch (counter) {
+        case Cycles: return "cycles";
+        case Instructions: return "instructions";
+        case L1Misses: return "L1d misses";
+        case LLCMisses: return "LLC misses";
+        case BranchMisses: return "branch misses";
+        default: return "";
+    }
+}
+
+inline bool PerfCounters::open (std::string& error) {
+    close();
+    std::size_t opened = 0;
+    for (int c = 0; c < CounterCount; ++c) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        switch (Counter(c)) {
+            case Cycles: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+            case Instructions: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+            case L1Misses:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                break;
+            case LLCMisses: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+            case BranchMisses: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+            default: break;
+        }
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1; // allowed with perf_event_paranoid = 2, the usual default
+        attr.exclude_hv = 1;
+        attr.disabled = c == Cycles; // the group starts once complete
+        int leader = c == Cycles ? -1 : fds[Cycles];
+        long fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        if (fd < 0) {
+            if (c == Cycles) {
+                error = std::string("perf_event_open: ") + std::strerror(errno);
+                return false;
+            }
+            continue; // e.g. no cache events on this CPU; the others are still useful
+        }
+        fds[c] = int(fd);
+        slots[c] = opened++;
+    }
+    ioctl(fds[Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+inline void PerfCounters::close () {
+    // members first, then the leader
+    for (int c = CounterCount - 1; c >= 0; --c) {
+        if (fds[c] >= 0) ::close(fds[c]);
+        fds[c] = -1;
+    }
+}
+
+inline bool PerfCounters::read (Values& values) const {
+    // group read layout: u64 count | u64 time enabled | u64 time running | u64 value of each counter, in the order they were opened
+    std::uint64_t data[3 + CounterCount];
+    if (!isOpen() || ::read(fds[Cycles], data, sizeof(data)) < ssize_t(3 * sizeof(std::uint64_t))) return false;
+    double scale = data[2] > 0 && data[2] < data[1] ? double(data[1]) / data[2] : 1.0;
+    for (int c = 0; c < CounterCount; ++c) {
+        values.counts[c] = fds[c] >= 0 && slots[c] < data[0] ? std::uint64_t(data[3 + slots[c]] * scale) : 0;
+    }
+    return true;
+}
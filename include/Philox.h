@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "Vec.h"
+
+/// Philox4x32-10 counter-based random number generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC11)
+/// Each output block is a pure function of a 128-bit counter and a 64-bit key, so there is no state to share or to advance between threads
+class Philox {
+    Philox()=delete;
+    Philox(const Philox&)=delete;
+    Philox(Philox&&)=delete;
+
+    static inline void mulhilo (std::uint32_t a, std::uint32_t b, std::uint32_t& hi, std::uint32_t& lo) {
+        std::uint64_t product = std::uint64_t(a) * std::uint64_t(b);
+        hi = std::uint32_t(product >> 32);
+        lo = std::uint32_t(product);
+    }
+
+    static inline std::uint32_t bitsOf (float x) { std::uint32_t b; std::memcpy(&b, &x, sizeof(b)); return b; }
+    static inline float floatOf (std::uint32_t b) { float x; std::memcpy(&x, &b, sizeof(x)); return x; }
+
+    // natural logarithm for x in (0, 1], branch-free so that loops calling it vectorize (Cephes logf polynomial, ~1 ulp)
+    static inline float logUnit (float x) {
+        std::uint32_t bits = bitsOf(x);
+        int e = int(bits >> 23) - 126;
+        float m = floatOf((bits & 0x007FFFFFu) | 0x3F000000u); // x = m * 2^e, m in [0.5, 1)
+        int small = m < 0.70710678f;
+        e -= small;
+        float f = m * float(1 + small) - 1.0f;
+        float z = f * f;
+        float y = 7.0376836292e-2f;
+        y = y * f - 1.1514610310e-1f;
+        y = y * f + 1.1676998740e-1f;
+        y = y * f - 1.2420140846e-1f;
+        y = y * f + 1.4249322787e-1f;
+        y = y * f - 1.6668057665e-1f;
+        y = y * f + 2.0000714765e-1f;
+        y = y * f - 2.4999993993e-1f;
+        y = y * f + 3.3333331174e-1f;
+        y = y * f * z;
+        float fe = float(e);
+        y = y + -2.12194440e-4f * fe;
+        y = y - 0.5f * z;
+        return f + y + 0.693359375f * fe;
+    }
+
+    // sine and cosine of 2 pi u for u in [0, 1), branch-free (octant reduction and Cephes sinf/cosf polynomials)
+    static inline void sinCosTurn (float u, float& s, float& c) {
+        float t = u * 8.0f;
+        int j = int(t);
+        j += j & 1;
+        float x = (t - float(j)) * (PI * 0.25f); // in [-pi/4, pi/4)
+        int quadrant = (j >> 1) & 3;
+        float z = x * x;
+        float sx = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * x + x;
+        float cx = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z - 0.5f * z + 1.0f;
+        // swap and negate through bit masks rather than selects, which the vectorizer would not if-convert under -ftrapping-math
+        std::uint32_t swap = 0u - std::uint32_t(quadrant & 1);
+        std::uint32_t sinSign = std::uint32_t(quadrant & 2) << 30, cosSign = std::uint32_t((quadrant + 1) & 2) << 30;
+        std::uint32_t sb = bitsOf(sx), cb = bitsOf(cx);
+        s = floatOf(((cb & swap) | (sb & ~swap)) ^ sinSign);
+        c = floatOf(((sb & swap) | (cb & ~swap)) ^ cosSign);
+    }
+
+public:
+
+    /// Independent sequences of draws for the same particle and timestep
+    enum Stream : std::uint32_t { Uniform = 0, Normal = 1, Seed = 2 };
+
+    /// Runs the 10 Philox rounds over counter c (in place) with key k
+    static inline void block (std::uint32_t c[4], std::uint32_t k0, std::uint32_t k1) {
+        #pragma GCC unroll 10
+        for (int round = 0; round < 10; ++round) {
+            std::uint32_t hi0, lo0, hi1, lo1;
+            mulhilo(0xD2511F53u, c[0], hi0, lo0);
+            mulhilo(0xCD9E8D57u, c[2], hi1, lo1);
+            std::uint32_t c0 = hi1 ^ c[1] ^ k0;
+            std::uint32_t c2 = hi0 ^ c[3] ^ k1;
+            c[0] = c0; c[1] = lo1; c[2] = c2; c[3] = lo0;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+    }
+
+    /// Block of 4 random words for the given seed, stream, particle, timestep and block index (i.e. draws 4 * index .. 4 * index + 3)
+    static inline void words (std::uint32_t out[4], std::uint32_t seed, Stream stream, std::uint64_t particle, std::uint64_t step, std::uint32_t index) {
+        out[0] = std::uint32_t(particle);
+        out[1] = std::uint32_t(step);
+        out[2] = std::uint32_t(step >> 32) ^ (std::uint32_t(particle >> 32) << 16);
+        out[3] = index;
+        block(out, seed, std::uint32_t(stream));
+    }
+
+    /// Uniform float in [0, 1) from a random word
+    static inline float toUniform (std::uint32_t word) {
+        return (word >> 8) * (1.0f / 16777216.0f);
+    }
+
+    /// Pair of independent standard normal floats from two random words (Box-Muller transform)
+    static inline void toNormals (std::uint32_t a, std::uint32_t b, float& z0, float& z1) {
+        float u = ((a >> 8) + 1) * (1.0f / 16777216.0f); // (0, 1], so that the log is finite
+        float r = std::sqrt(-2.0f * logUnit(u));
+        float s, c;
+        sinCosTurn(toUniform(b), s, c);
+        z0 = r * c;
+        z1 = r * s;
+    }
+
+    /// Fills out[0..count) with draws firstDraw .. firstDraw + count - 1 of uniform floats in [0, 1)
+    static inline void uniforms (std::uint32_t seed, std::uint64_t particle, std::uint64_t step, unsigned int firstDraw, float* out, unsigned int count) {
+        std::uint32_t w[4];
+        for (unsigned int k = 0; k < count; ++k) {
+            unsigned int draw = firstDraw + k;
+            if (k == 0 || draw % 4 == 0) words(w, seed, Uniform, particle, step, draw / 4);
+            out[k] = toUniform(w[draw % 4]);
+        }
+    }
+
+    /// Fills out[0..count) with draws firstDraw .. firstDraw + count - 1 of standard normal floats
+    static inline void normals (std::uint32_t seed, std::uint64_t particle, std::uint64_t step, unsigned int firstDraw, float* out, unsigned int count) {
+        std::uint32_t w[4];
+        float z[4];
+        for (unsigned int k = 0; k < count; ++k) {
+            unsigned int draw = firstDraw + k;
+            if (k == 0 || draw % 4 == 0) {
+                words(w, seed, Normal, particle, step, draw / 4);
+                toNormals(w[0], w[1], z[0], z[1]);
+                toNormals(w[2], w[3], z[2], z[3]);
+            }
+            out[k] = z[draw % 4];
+        }
+    }
+
+    /// Fills out[i * perParticle + d] with normal draw d of particle i, for all particles i in [0, count) and d in [0, perParticle), perParticle <= 4
+    /// i.e. the same values as normals(seed, i, step, 0, ..., perParticle), computed in vectorized passes over blocks of particles
+    /// If ids is given, the draws of particle ids[i] are stored for each i instead (e.g. when only a subset of the particles is held)
+    __attribute__((target_clones("avx2", "default")))
+    static void fillNormals (std::uint32_t seed, std::uint64_t step, std::size_t count, unsigned int perParticle, float* out, const std::uint64_t* ids = nullptr) {
+        const std::size_t blockSize = 4096;
+        #pragma omp parallel for
+        for (std::size_t begin = 0; begin < count; begin += blockSize) {
+            std::size_t end = std::min(count, begin + blockSize);
+            if (ids != nullptr) {
+                switch (perParticle) {
+                    case 1: fillNormalsRange<1, true>(seed, step, begin, end, out, ids); break;
+                    case 2: fillNormalsRange<2, true>(seed, step, begin, end, out, ids); break;
+                    case 3: fillNormalsRange<3, true>(seed, step, begin, end, out, ids); break;
+                    default: fillNormalsRange<4, true>(seed, step, begin, end, out, ids); break;
+                }
+            } else {
+                switch (perParticle) {
+                    case 1: fillNormalsRange<1, false>(seed, step, begin, end, out, ids); break;
+                    case 2: fillNormalsRange<2, false>(seed, step, begin, end, out, ids); break;
+                    case 3: fillNormalsRange<3, false>(seed, step, begin, end, out, ids); break;
+                    default: fillNormalsRange<4, false>(seed, step, begin, end, out, ids); break;
+                }
+            }
+        }
+    }
+
+private:
+
+    // one SIMD pass over particles [begin, end); inlined into each clone of fillNormals so that it is compiled for that instruction set
+    // (AVX-512 is deliberately left out: on many CPUs the frequency drop outweighs the wider vectors for this mix of integer and float work)
+    template<unsigned int PerParticle, bool Indexed>
+    __attribute__((always_inline)) static inline void fillNormalsRange (std::uint32_t seed, std::uint64_t step, std::size_t begin, std::size_t end, float* out,
+            const std::uint64_t* ids) {
+        // same computation as words() and toNormals(), spelled out over scalars since the vectorizer does not look through small local arrays
+        const std::uint32_t c1 = std::uint32_t(step), c2 = std::uint32_t(step >> 32);
+        #pragma omp simd
+        for (std::size_t i = begin; i < end; ++i) {
+            std::uint64_t particle = Indexed ? ids[i] : std::uint64_t(i);
+            std::uint32_t w0 = std::uint32_t(particle), w1 = c1, w2 = c2 ^ (std::uint32_t(particle >> 32) << 16), w3 = 0;
+            std::uint32_t k0 = seed, k1 = Normal;
+            #pragma GCC unroll 10
+            for (int round = 0; round < 10; ++round) {
+                std::uint64_t p0 = std::uint64_t(0xD2511F53u) * w0, p1 = std::uint64_t(0xCD9E8D57u) * w2;
+                std::uint32_t n0 = std::uint32_t(p1 >> 32) ^ w1 ^ k0;
+                std::uint32_t n2 = std::uint32_t(p0 >> 32) ^ w3 ^ k1;
+                w1 = std::uint32_t(p1); w3 = std::uint32_t(p0);
+                w0 = n0; w2 = n2;
+                k0 += 0x9E3779B9u;
+                k1 += 0xBB67AE85u;
+            }
+            float z0, z1, z2, z3;
+            toNormals(w0, w1, z0, z1);
+            float* o = out + i * PerParticle;
+            o[0] = z0;
+            if (PerParticle > 1) o[1] = z1;
+            if (PerParticle > 2) {
+                toNormals(w2, w3, z2, z3);
+                o[2] = z2;
+                if (PerParticle > 3) o[3] = z3;
+            }
+        }
+    }
+
+};
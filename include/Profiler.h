@@ -0,0 +1,348 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <map>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+#include <omp.h>
+#include "PerfCounters.h"
+
+// Instrumentation is compiled in unless built with AMM_PROFILING=0 (make PROFILING=0), in which case timers compile to nothing
+#ifndef AMM_PROFILING
+    #define AMM_PROFILING 1
+#endif
+
+/// Low-overhead instrumentation of the hot paths: scoped timers record named intervals on each thread, from which a summary table and a Chrome trace
+/// (trace_event format, to be loaded in chrome://tracing or https://ui.perfetto.dev) are produced at the end of the run
+/// Timers placed inside parallel regions record one interval per thread, and thus show how unevenly threads finish their share of a loop
+/// Each thread logs to its own buffer, so timers never contend; while profiling is disabled at runtime, a timer costs a single branch
+/// Hardware counters (see PerfCounters) can be sampled along with the times, at the cost of two system calls per timer
+class Profiler {
+    Profiler()=delete;
+    Profiler(const Profiler&)=delete;
+    Profiler(Profiler&&)=delete;
+
+    struct Event {
+        const char* name;
+        std::uint64_t start, duration; // nanoseconds since profiling was enabled
+        std::uint64_t step;
+    };
+    struct Totals {
+        const char* name;
+        std::uint64_t calls = 0, total = 0, max = 0;
+        std::uint64_t countedCalls = 0; // calls for which hardware counters were read
+        PerfCounters::Values counts;
+    };
+    struct ThreadLog {
+        std::size_t id;
+        std::string label;
+        std::vector<Event> events;  // kept up to MaxEventsPerThread, for the trace and the load imbalance
+        std::vector<PerfCounters::Values> eventCounts; // hardware counters of each event, if counting
+        std::vector<Totals> totals; // over all events, per name
+        bool truncated = false;
+        PerfCounters perf;      // opened on the first timer of the thread
+        bool perfOpened = false;
+        bool perfFailed = false;
+    };
+    struct State {
+        bool enabled = false;
+        bool counting = false;
+        bool available[PerfCounters::CounterCount] = { };
+        std::uint64_t step = 0;
+        std::chrono::steady_clock::time_point epoch;
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadLog>> threads;
+    };
+
+    static State& state () {
+        static State s;
+        return s;
+    }
+
+    // log of the calling thread, registered on first use
+    static ThreadLog& local ();
+
+public:
+
+    static constexpr std::size_t MaxEventsPerThread = 1 << 18;
+
+    static inline bool enabled () { return state().enabled; }
+
+    /// Starts recording; timers opened before are ignored
+    /// With counters, hardware counters are sampled too if the system allows it, otherwise a warning is printed and only times are recorded
+    static void enable (bool counters = false);
+
+    static inline bool counting () { return state().counting; }
+
+    /// Reads the hardware counters of the calling thread; returns false if they could not be opened on this thread
+    static bool readCounters (PerfCounters::Values& values);
+
+    /// Timestep the intervals recorded from now on belong to, used to compare threads within the same step
+    static inline void setStep (std::uint64_t step) { state().step = step; }
+
+    /// Label of the calling thread in the trace (OpenMP threads are labelled by their number otherwise)
+    static void nameThread (const std::string& label);
+
+    static inline std::uint64_t now () {
+        return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - state().epoch).count());
+    }
+
+    /// Records an interval on the calling thread, with the hardware counts over it if any; name must outlive the profiler (i.e. be a string literal)
+    static void record (const char* name, std::uint64_t start, std::uint64_t duration, const PerfCounters::Values* counts = nullptr);
+
+    /// Prints the time spent in each named interval, with the load imbalance of those timed per thread, and writes the Chrome trace to tracePath
+    /// When counting, also prints metrics derived from the hardware counters, per particle update where particleUpdates is the number of updates over the run
+    static void report (const std::string& tracePath, std::uint64_t particleUpdates = 0);
+
+};
+
+/// Times the enclosing scope under the given name, if profiling is enabled; see PROFILE_SCOPE
+class ProfileScope {
+
+    const char* name;
+    std::uint64_t start = 0;
+    bool active;
+    bool counted = false;
+    PerfCounters::Values counts; // at the start of the scope
+
+public:
+
+    ProfileScope (const char* name) : name(name), active(Profiler::enabled()) {
+        if (!active) return;
+        if (Profiler::counting()) counted = Profiler::readCounters(counts);
+        start = Profiler::now();
+    }
+    ProfileScope (const ProfileScope&)=delete;
+    ProfileScope (ProfileScope&&)=delete;
+
+    ~ProfileScope () {
+        if (!active) return;
+        std::uint64_t duration = Profiler::now() - start;
+        PerfCounters::Values end;
+        if (counted && Profiler::readCounters(end)) {
+            for (int c = 0; c < PerfCounters::CounterCount; ++c) {
+                counts.counts[c] = end.counts[c] - counts.counts[c];
+            }
+            Profiler::record(name, start, duration, &counts);
+        } else {
+            Profiler::record(name, start, duration);
+        }
+    }
+
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#if AMM_PROFILING
+    #define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+    #define PROFILE_SCOPE(name)
+#endif
+
+
+
+inline Profiler::ThreadLog& Profiler::local () {
+    thread_local ThreadLog* log = nullptr;
+    if (log == nullptr) {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.threads.emplace_back(new ThreadLog());
+        log = s.threads.back().get();
+        log->id = s.threads.size() - 1;
+        log->label = "OpenMP thread " + std::to_string(omp_get_thread_num());
+    }
+    return *log;
+}
+
+inline void Profiler::enable (bool counters) {
+    State& s = state();
+    if (counters) {
+        // probe on the calling thread, so that unavailable counters are reported once rather than silently missing from every thread
+        PerfCounters probe;
+        std::string error;
+        if (probe.open(error)) {
+            s.counting = true;
+            for (int c = 0; c < PerfCounters::CounterCount; ++c) {
+                s.available[c] = probe.available(PerfCounters::Counter(c));
+            }
+        } else {
+            std::printf("Hardware counters are unavailable (%s), only times will be profiled!\n", error.c_str());
+        }
+    }
+    s.epoch = std::chrono::steady_clock::now();
+    s.enabled = true;
+}
+
+inline bool Profiler::readCounters (PerfCounters::Values& values) {
+    ThreadLog& log = local();
+    if (!log.perfOpened && !log.perfFailed) {
+        std::string error;
+        log.perfOpened = log.perf.open(error);
+        log.perfFailed = !log.perfOpened;
+    }
+    return log.perfOpened && log.perf.read(values);
+}
+
+inline void Profiler::nameThread (const std::string& label) {
+    ThreadLog& log = local();
+    std::lock_guard<std::mutex> lock(state().mutex);
+    log.label = label;
+}
+
+inline void Profiler::record (const char* name, std::uint64_t start, std::uint64_t duration, const PerfCounters::Values* counts) {
+    ThreadLog& log = local();
+    Totals* totals = nullptr;
+    for (Totals& t : log.totals) {
+        if (t.name == name) {
+            totals = &t;
+            break;
+        }
+    }
+    if (totals == nullptr) {
+        log.totals.push_back(Totals());
+        totals = &log.totals.back();
+        totals->name = name;
+    }
+    ++totals->calls;
+    totals->total += duration;
+    totals->max = std::max(totals->max, duration);
+    if (counts != nullptr) {
+        ++totals->countedCalls;
+        for (int c = 0; c < PerfCounters::CounterCount; ++c) {
+            totals->counts.counts[c] += counts->counts[c];
+        }
+    }
+
+    if (log.events.size() < MaxEventsPerThread) {
+        log.events.push_back({ name, start, duration, state().step });
+        if (state().counting) log.eventCounts.push_back(counts != nullptr ? *counts : PerfCounters::Values());
+    } else {
+        log.truncated = true;
+    }
+}
+
+inline void Profiler::report (const std::string& tracePath, std::uint64_t particleUpdates) {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    // totals per name over all threads, in order of first appearance; names are compared by value as the same literal may have several addresses
+    struct Summary {
+        std::uint64_t calls = 0, total = 0, max = 0;
+        std::size_t threads = 0;
+        std::uint64_t countedCalls = 0;
+        PerfCounters::Values counts;
+        // per step, time spent by each thread, from which the imbalance is derived
+        std::map<std::uint64_t, std::map<std::size_t, std::uint64_t>> perStep;
+    };
+    std::vector<std::pair<std::string, Summary>> summaries;
+    auto summaryOf = [&summaries](const char* name) -> Summary& {
+        for (auto& entry : summaries) {
+            if (entry.first.compare(name) == 0) return entry.second;
+        }
+        summaries.push_back({ name, Summary() });
+        return summaries.back().second;
+    };
+    bool truncated = false;
+    std::size_t uncountedThreads = 0;
+    for (const auto& log : s.threads) {
+        if (log->perfFailed) ++uncountedThreads;
+        for (const Totals& t : log->totals) {
+            Summary& summary = summaryOf(t.name);
+            summary.calls += t.calls;
+            summary.total += t.total;
+            summary.max = std::max(summary.max, t.max);
+            ++summary.threads;
+            summary.countedCalls += t.countedCalls;
+            for (int c = 0; c < PerfCounters::CounterCount; ++c) {
+                summary.counts.counts[c] += t.counts.counts[c];
+            }
+        }
+        for (const Event& e : log->events) {
+            summaryOf(e.name).perStep[e.step][log->id] += e.duration;
+        }
+        truncated |= log->truncated;
+    }
+
+    std::printf("Profile (times summed over threads; imbalance is the mean ratio of the slowest thread to the average one, per step):\n");
+    std::printf("%-24s %10s %12s %12s %12s %8s %10s\n", "phase", "calls", "total (s)", "mean (ms)", "max (ms)", "threads", "imbalance");
+    for (const auto& entry : summaries) {
+        const Summary& summary = entry.second;
+        double imbalance = 0;
+        std::size_t steps = 0;
+        for (const auto& step : summary.perStep) {
+            if (step.second.size() < 2) continue;
+            std::uint64_t slowest = 0, sum = 0;
+            for (const auto& thread : step.second) {
+                slowest = std::max(slowest, thread.second);
+                sum += thread.second;
+            }
+            if (sum == 0) continue;
+            imbalance += double(slowest) * step.second.size() / sum;
+            ++steps;
+        }
+        std::printf("%-24s %10lu %12.4f %12.4f %12.4f %8ld", entry.first.c_str(), summary.calls, summary.total * 1e-9, summary.total * 1e-6 / summary.calls,
+            summary.max * 1e-6, summary.threads);
+        if (steps > 0) std::printf(" %10.3f\n", imbalance / steps);
+        else std::printf(" %10s\n", "-");
+    }
+    if (truncated) std::printf("(only the first %ld intervals of each thread are kept in the trace and imbalance figures)\n", MaxEventsPerThread);
+
+    // hardware counters: IPC, then misses per particle update, and the memory traffic they imply (one cache line per last level miss)
+    if (s.counting) {
+        auto perUpdate = [&s, particleUpdates](const Summary& summary, PerfCounters::Counter counter, double factor) {
+            if (!s.available[counter] || particleUpdates == 0) std::printf(" %12s", "-");
+            else std::printf(" %12.4f", summary.counts.counts[counter] * factor / particleUpdates);
+        };
+        std::printf("\nHardware counters (user space, summed over threads; per particle update over %lu updates):\n", particleUpdates);
+        std::printf("%-24s %8s %12s %12s %12s %12s\n", "phase", "IPC", "L1d miss", "LLC miss", "branch miss", "DRAM bytes");
+        for (const auto& entry : summaries) {
+            const Summary& summary = entry.second;
+            if (summary.countedCalls == 0) continue;
+            std::printf("%-24s", entry.first.c_str());
+            if (s.available[PerfCounters::Instructions] && summary.counts.counts[PerfCounters::Cycles] > 0) {
+                std::printf(" %8.3f", double(summary.counts.counts[PerfCounters::Instructions]) / summary.counts.counts[PerfCounters::Cycles]);
+            } else {
+                std::printf(" %8s", "-");
+            }
+            perUpdate(summary, PerfCounters::L1Misses, 1.0);
+            perUpdate(summary, PerfCounters::LLCMisses, 1.0);
+            perUpdate(summary, PerfCounters::BranchMisses, 1.0);
+            perUpdate(summary, PerfCounters::LLCMisses, double(PerfCounters::CacheLineSize));
+            std::printf("\n");
+        }
+        if (uncountedThreads > 0) std::printf("(counters could not be opened on %ld threads, whose intervals are left out)\n", uncountedThreads);
+    }
+
+    // Chrome trace: one complete ("X") event per interval, with timestamps in microseconds, and the thread labels as metadata
+    std::FILE* file = std::fopen(tracePath.c_str(), "w");
+    if (file == nullptr) {
+        std::printf("Could not open trace file %s for writing!\n", tracePath.c_str());
+        return;
+    }
+    std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const auto& log : s.threads) {
+        std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", log->id, log->label.c_str());
+        first = false;
+        for (std::size_t k = 0; k < log->events.size(); ++k) {
+            const Event& e = log->events[k];
+            std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"step\":%lu",
+                e.name, log->id, e.start * 1e-3, e.duration * 1e-3, e.step);
+            if (log->perfOpened && k < log->eventCounts.size()) {
+                for (int c = 0; c < PerfCounters::CounterCount; ++c) {
+                    if (s.available[c]) std::fprintf(file, ",\"%s\":%lu", PerfCounters::name(PerfCounters::Counter(c)), log->eventCounts[k].counts[c]);
+                }
+            }
+            std::fprintf(file, "}}");
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+    std::fclose(file);
+    std::printf("Wrote trace to %s\n", tracePath.c_str());
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <omp.h>
+#include "Vec.h"
+
+/// Orders particles along a space-filling curve (Morton, i.e. Z-order) through the cells of a uniform grid, so that particles close to each other in
+/// space end up close to each other in memory, and the neighbours visited by a neighbour search mostly share cache lines
+/// Keys interleave the bits of the cell coordinates along each axis; they are sorted with a parallel, stable LSD radix sort
+template<int D>
+class SpatialSort {
+
+    std::vector<std::uint32_t> keys, sortedKeys;
+    std::vector<std::uint32_t> order, sortedOrder;
+    std::vector<std::size_t> offsets; // per thread and per digit, see radixPass
+
+    // cell coordinates along each axis are clamped to this many bits, so that keys fit in 32 bits
+    static constexpr int BitsPerAxis = 32 / D;
+    static constexpr int DigitBits = 8;
+    static constexpr std::size_t Digits = std::size_t(1) << DigitBits;
+
+    // spreads the lowest BitsPerAxis bits of c, D - 1 zero bits apart
+    static inline std::uint32_t spread (std::uint32_t c) {
+        std::uint32_t key = 0;
+        for (int b = 0; b < BitsPerAxis; ++b) key |= ((c >> b) & 1u) << (b * D);
+        return key;
+    }
+
+    // stable scatter of (keys, order) into (sortedKeys, sortedOrder) by the digit of each key at shift; each thread counts then scatters its own chunk
+    void radixPass (std::size_t count, int shift);
+
+public:
+
+    /// Permutation sorting count particles along the curve, i.e. the index of the particle to move to each position, where position(i) returns the
+    /// Vec<D> position of particle i; the grid spans the particles' bounding box with cells of cellSize, enlarged if it would need too many cells
+    template<typename PosFn>
+    const std::vector<std::uint32_t>& sort (std::size_t count, PosFn position, float cellSize);
+
+};
+
+
+
+template<int D>
+template<typename PosFn>
+const std::vector<std::uint32_t>& SpatialSort<D>::sort (std::size_t count, PosFn position, float cellSize) {
+    // bounding box of all particles
+    float lo[D], size[D];
+    for (int d = 0; d < D; ++d) {
+        float dMin = std::numeric_limits<float>::max(), dMax = std::numeric_limits<float>::lowest();
+        #pragma omp parallel for reduction(min: dMin) reduction(max: dMax)
+        for (std::size_t i = 0; i < count; ++i) {
+            float x = position(i)[d];
+            dMin = std::min(dMin, x);
+            dMax = std::max(dMax, x);
+        }
+        lo[d] = dMin;
+        size[d] = std::max(cellSize, (dMax - dMin) / float(1u << BitsPerAxis) * 1.0001f);
+    }
+
+    keys.resize(count);
+    order.resize(count);
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < count; ++i) {
+        Vec<D> pos = position(i);
+        std::uint32_t key = 0;
+        for (int d = 0; d < D; ++d) {
+            std::uint32_t c = std::uint32_t(std::max(0.0f, (pos[d] - lo[d]) / size[d]));
+            key |= spread(std::min(c, (1u << BitsPerAxis) - 1)) << d;
+        }
+        keys[i] = key;
+        order[i] = std::uint32_t(i);
+    }
+
+    // only the bits set in some key need sorting on, e.g. the lowest 2 * D * 6 ones with 64 cells per axis
+    std::uint32_t allKeys = 0;
+    #pragma omp parallel for reduction(|: allKeys)
+    for (std::size_t i = 0; i < count; ++i) allKeys |= keys[i];
+    int usedBits = 0;
+    while (usedBits < 32 && (allKeys >> usedBits) != 0) ++usedBits;
+
+    sortedKeys.resize(count);
+    sortedOrder.resize(count);
+    for (int shift = 0; shift < usedBits; shift += DigitBits) {
+        radixPass(count, shift);
+        keys.swap(sortedKeys);
+        order.swap(sortedOrder);
+    }
+    return order;
+}
+
+template<int D>
+void SpatialSort<D>::radixPass (std::size_t count, int shift) {
+    offsets.assign(std::size_t(omp_get_max_threads()) * Digits, 0);
+    #pragma omp parallel
+    {
+        std::size_t threads = omp_get_num_threads(), t = omp_get_thread_num();
+        std::size_t begin = count * t / threads, end = count * (t + 1) / threads;
+        std::size_t* counts = &offsets[t * Digits];
+        for (std::size_t i = begin; i < end; ++i) ++counts[(keys[i] >> shift) & (Digits - 1)];
+        #pragma omp barrier
+
+        // exclusive prefix sum over digits, then threads, so that each thread scatters its chunk after those of lower threads
+        #pragma omp single
+        {
+            std::size_t sum = 0;
+            for (std::size_t digit = 0; digit < Digits; ++digit) {
+                for (std::size_t u = 0; u < threads; ++u) {
+                    std::size_t n = offsets[u * Digits + digit];
+                    offsets[u * Digits + digit] = sum;
+                    sum += n;
+                }
+            }
+        }
+
+        for (std::size_t i = begin; i < end; ++i) {
+            std::size_t at = counts[(keys[i] >> shift) & (Digits - 1)]++;
+            sortedKeys[at] = keys[i];
+            sortedOrder[at] = order[i];
+        }
+    }
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "Vec.h"
+
+/// Encoding of particle positions within a version 2 trajectory file
+enum class PositionEncoding : std::uint32_t {
+    Float32 = 0, // raw floats
+    Fixed16 = 1, // 16-bit fixed point over the periodic box [-periodicity, periodicity), i.e. a resolution of periodicity / 32768
+};
+
+/// Encoding of particle orientations within a version 2 trajectory file
+enum class OrientationEncoding : std::uint32_t {
+    None = 0,       // not stored
+    Directions = 1, // D floats, unit direction vector (as in version 1 files)
+    Angles = 2,     // D-1 floats, angles as stored by the models (theta in 2D; theta and phi in 3D)
+};
+
+/// Global header of a version 2 trajectory file, i.e. everything which is common to all of its frames
+struct TrajectoryHeader {
+    enum Flags : std::uint32_t {
+        Compressed = 1, // frames are encoded by TrajectoryCodec, and have variable sizes
+    };
+    
+    std::uint32_t dimension = 2;
+    std::uint64_t particleCount = 0;
+    std::uint32_t saveEvery = 0; // number of timesteps between saved frames; 0 if unknown
+    std::uint32_t seed = 0;
+    float periodicity = 0; // half size of the periodic box, <= 0 if not periodic
+    float boundary = 0;
+    PositionEncoding positions = PositionEncoding::Float32;
+    OrientationEncoding orientations = OrientationEncoding::Directions;
+    std::uint32_t flags = 0; // combination of Flags
+    std::uint32_t keyframeInterval = 0; // for compressed files, number of frames between keyframes
+    std::string model;     // model name
+    std::string arguments; // command line the file was produced with, which holds all model parameters
+
+    std::size_t positionBytes () const { return positions == PositionEncoding::Fixed16 ? 2 : 4; }
+    std::uint32_t orientationComponents () const {
+        return orientations == OrientationEncoding::Directions ? dimension : orientations == OrientationEncoding::Angles ? dimension - 1 : 0;
+    }
+
+    bool compressed () const { return (flags & Compressed) != 0; }
+
+    // byte offsets of each array within an uncompressed frame, and total frame size; see Trajectory for the layout
+    std::size_t positionsOffset (std::uint32_t d) const;
+    std::size_t orientationsOffset (std::uint32_t d) const;
+    std::size_t frameSize () const;
+};
+
+/// Version 2 trajectory files: one global header, then fixed-size frames, then an index of frame offsets
+/// All values are little-endian; the header and every array within a frame start on a 64-byte boundary, so that mapped files can be read in place
+///
+/// Header (padded with zeros to a multiple of 64 bytes):
+///   "AMM2" | u32 version (2) | u32 header size | u32 dimension | u64 particle count | u32 save cadence | u32 seed
+///   | f32 periodicity | f32 boundary | u32 position encoding | u32 orientation encoding | u32 flags | u32 keyframe interval
+///   | model name (null-terminated) | command line arguments (null-terminated)
+/// Frame:
+///   u64 step (padded to 64 bytes) | D position arrays of N values each | orientation arrays of N floats each, if any (each array padded to 64 bytes)
+///   Compressed files (see TrajectoryCodec) instead hold variable-size frames, which record their own size
+/// Index (optional, missing if the run did not complete; frames can then still be located from the fixed frame size, or from the recorded sizes):
+///   u64 offset of each frame from the start of the file | u64 frame count | "AMM2IDX\0"
+class Trajectory {
+    Trajectory()=delete;
+    Trajectory(const Trajectory&)=delete;
+    Trajectory(Trajectory&&)=delete;
+public:
+
+    static constexpr std::size_t Alignment = 64;
+    static constexpr std::uint32_t Version = 2;
+    static constexpr std::size_t MinHeaderSize = 56; // fixed-size fields only
+    static constexpr std::size_t IndexFooterSize = 16;
+
+    static inline std::size_t align (std::size_t size) { return (size + Alignment - 1) / Alignment * Alignment; }
+
+    /// Fixed-point conversion of a coordinate within the periodic box [-periodicity, periodicity); wraps around for out-of-box values
+    static inline std::uint16_t quantise (float x, float periodicity) {
+        float scaled = std::floor((x + periodicity) * (32768.0f / periodicity) + 0.5f);
+        return std::uint16_t(std::int64_t(scaled) & 0xFFFF);
+    }
+    static inline float dequantise (std::uint16_t q, float periodicity) {
+        return q * (periodicity / 32768.0f) - periodicity;
+    }
+
+    static std::size_t headerSize (const TrajectoryHeader& header) {
+        return align(MinHeaderSize + header.model.size() + 1 + header.arguments.size() + 1);
+    }
+
+    /// Appends the header to data
+    static void writeHeader (std::vector<std::uint8_t>& data, const TrajectoryHeader& header);
+
+    /// Reads a header from the first size bytes of a file; returns false if they do not hold a valid version 2 header
+    static bool readHeader (const std::uint8_t* data, std::size_t size, TrajectoryHeader& header, std::size_t& headerSize);
+
+    /// Appends the index of frame offsets to data
+    static void writeIndex (std::vector<std::uint8_t>& data, const std::vector<std::uint64_t>& offsets);
+
+    /// Reads the index at the end of a file of the given size, if there is one; returns false (leaving offsets empty) otherwise
+    static bool readIndex (const std::uint8_t* data, std::size_t size, std::vector<std::uint64_t>& offsets);
+
+    /// Unaligned stores and loads of trivial values, as laid out in files
+    template<typename T>
+    static inline void put (std::uint8_t* at, const T& val) { std::memcpy(at, &val, sizeof(T)); }
+    template<typename T>
+    static inline T get (const std::uint8_t* at) { T val; std::memcpy(&val, at, sizeof(T)); return val; }
+
+};
+
+
+
+inline std::size_t TrajectoryHeader::positionsOffset (std::uint32_t d) const {
+    return Trajectory::Alignment + d * Trajectory::align(particleCount * positionBytes());
+}
+
+inline std::size_t TrajectoryHeader::orientationsOffset (std::uint32_t d) const {
+    return positionsOffset(dimension) + d * Trajectory::align(particleCount * sizeof(float));
+}
+
+inline std::size_t TrajectoryHeader::frameSize () const {
+    return orientationsOffset(orientationComponents());
+}
+
+inline void Trajectory::writeHeader (std::vector<std::uint8_t>& data, const TrajectoryHeader& header) {
+    std::size_t start = data.size(), size = headerSize(header);
+    data.resize(start + size, 0);
+    std::uint8_t* at = &data[start];
+    std::memcpy(at, "AMM2", 4);
+    put<std::uint32_t>(at + 4, Version);
+    put<std::uint32_t>(at + 8, std::uint32_t(size));
+    put<std::uint32_t>(at + 12, header.dimension);
+    put<std::uint64_t>(at + 16, header.particleCount);
+    put<std::uint32_t>(at + 24, header.saveEvery);
+    put<std::uint32_t>(at + 28, header.seed);
+    put<float>(at + 32, header.periodicity);
+    put<float>(at + 36, header.boundary);
+    put<std::uint32_t>(at + 40, std::uint32_t(header.positions));
+    put<std::uint32_t>(at + 44, std::uint32_t(header.orientations));
+    put<std::uint32_t>(at + 48, header.flags);
+    put<std::uint32_t>(at + 52, header.keyframeInterval);
+    std::memcpy(at + MinHeaderSize, header.model.c_str(), header.model.size() + 1);
+    std::memcpy(at + MinHeaderSize + header.model.size() + 1, header.arguments.c_str(), header.arguments.size() + 1);
+}
+
+inline bool Trajectory::readHeader (const std::uint8_t* data, std::size_t size, TrajectoryHeader& header, std::size_t& headerSize) {
+    if (size < MinHeaderSize || std::memcmp(data, "AMM2", 4) != 0 || get<std::uint32_t>(data + 4) != Version) return false;
+    headerSize = get<std::uint32_t>(data + 8);
+    if (headerSize < MinHeaderSize || headerSize > size) return false;
+    header.dimension = get<std::uint32_t>(data + 12);
+    header.particleCount = get<std::uint64_t>(data + 16);
+    header.saveEvery = get<std::uint32_t>(data + 24);
+    header.seed = get<std::uint32_t>(data + 28);
+    header.periodicity = get<float>(data + 32);
+    header.boundary = get<float>(data + 36);
+    header.positions = PositionEncoding(get<std::uint32_t>(data + 40));
+    header.orientations = OrientationEncoding(get<std::uint32_t>(data + 44));
+    header.flags = get<std::uint32_t>(data + 48);
+    header.keyframeInterval = get<std::uint32_t>(data + 52);
+    if (header.dimension < 2 || header.dimension > 3 || header.positions > PositionEncoding::Fixed16 || header.orientations > OrientationEncoding::Angles) return false;
+    const char* strings = reinterpret_cast<const char*>(data + MinHeaderSize);
+    std::size_t stringsSize = headerSize - MinHeaderSize;
+    header.model = std::string(strings, strnlen(strings, stringsSize));
+    std::size_t next = std::min(header.model.size() + 1, stringsSize);
+    header.arguments = std::string(strings + next, strnlen(strings + next, stringsSize - next));
+    return true;
+}
+
+inline void Trajectory::writeIndex (std::vector<std::uint8_t>& data, const std::vector<std::uint64_t>& offsets) {
+    std::size_t start = data.size();
+    data.resize(start + offsets.size() * sizeof(std::uint64_t) + IndexFooterSize);
+    std::uint8_t* at = &data[start];
+    std::memcpy(at, offsets.data(), offsets.size() * sizeof(std::uint64_t));
+    at += offsets.size() * sizeof(std::uint64_t);
+    put<std::uint64_t>(at, offsets.size());
+    std::memcpy(at + 8, "AMM2IDX", 8);
+}
+
+inline bool Trajectory::readIndex (const std::uint8_t* data, std::size_t size, std::vector<std::uint64_t>& offsets) {
+    offsets.clear();
+    if (size < IndexFooterSize || std::memcmp(data + size - 8, "AMM2IDX", 8) != 0) return false;
+    std::uint64_t count = get<std::uint64_t>(data + size - IndexFooterSize);
+    if (count > (size - IndexFooterSize) / sizeof(std::uint64_t)) return false;
+    offsets.resize(count);
+    std::memcpy(offsets.data(), data + size - IndexFooterSize - count * sizeof(std::uint64_t), count * sizeof(std::uint64_t));
+    return true;
+}
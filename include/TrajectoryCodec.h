@@ -0,0 +1,264 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "Trajectory.h"
+
+/// Lossless codec for version 2 trajectory frames, used when the header has the Compressed flag
+/// Each field is split into blocks of particles, encoded independently (and in parallel). Within a block, each value is replaced by its difference with a
+/// prediction, as integers over the raw bits: the same value in the previous frame, or for positions its linear extrapolation from the two previous frames,
+/// since active particles keep moving in roughly the same direction (in keyframes, the previous particle's value). Differences are zigzag-encoded so that
+/// small changes of either sign map to small numbers, then bit-packed in groups of 32, each group using as many bits as its largest residual needs
+/// Keyframes are inserted every keyframeInterval frames, so that any frame can be decoded from the closest keyframe before it
+///
+/// Compressed frame (padded to 64 bytes):
+///   u64 step | u32 kind (see Kind) | u32 block count | u64 frame size | padding to 64 bytes
+///   | u64 offset of each block from the start of the frame, plus one past the end of the last block (padded to 64 bytes) | blocks
+/// Block: for each field in file order (positions, then orientations), for each group of 32 particles: u8 bit width w | 4 * w bytes of packed residuals
+class TrajectoryCodec {
+
+    TrajectoryHeader header;
+    std::size_t fieldCount;
+    std::size_t blockCount;
+
+    std::vector<std::uint8_t> previous, beforePrevious; // last two frames encoded or decoded, in the raw (uncompressed) layout
+    std::size_t framesSinceKeyframe = 0;
+    std::vector<std::vector<std::uint8_t>> blocks; // per-block scratch buffers, kept across frames
+
+    std::size_t fieldOffset (std::size_t f) const {
+        return f < header.dimension ? header.positionsOffset(f) : header.orientationsOffset(f - header.dimension);
+    }
+    bool isPosition (std::size_t f) const { return f < header.dimension; }
+    std::size_t fieldWordSize (std::size_t f) const {
+        return f < header.dimension ? header.positionBytes() : sizeof(float);
+    }
+
+    // value predicted for particle i from the previous frames (linear extrapolation when two are available), or from the previous particle in keyframes
+    template<typename Word>
+    static inline Word predict (const std::uint8_t* reference, const std::uint8_t* reference2, std::size_t i, Word previousValue) {
+        if (reference == nullptr) return previousValue;
+        Word ref;
+        std::memcpy(&ref, reference + i * sizeof(Word), sizeof(Word));
+        if (reference2 == nullptr) return ref;
+        Word ref2;
+        std::memcpy(&ref2, reference2 + i * sizeof(Word), sizeof(Word));
+        return Word(ref + ref - ref2);
+    }
+
+    template<typename Word>
+    static void encodeField (const std::uint8_t* values, const std::uint8_t* reference, const std::uint8_t* reference2, std::size_t begin, std::size_t end, std::vector<std::uint8_t>& out);
+    // returns the end of the field's groups, or nullptr if they would run past inEnd, or a bit width is out of range (i.e. the frame is corrupted)
+    template<typename Word>
+    static const std::uint8_t* decodeField (const std::uint8_t* in, const std::uint8_t* inEnd, const std::uint8_t* reference, const std::uint8_t* reference2, std::size_t begin, std::size_t end, std::uint8_t* values);
+
+public:
+
+    static constexpr std::size_t BlockSize = 8192; // particles per block
+    static constexpr std::size_t GroupSize = 32;   // values sharing one bit width
+    static constexpr std::size_t PreambleSize = 64;
+
+    /// Kinds of compressed frames, by what their values are predicted from
+    enum Kind : std::uint32_t {
+        Keyframe = 0,     // the previous particle within the same frame
+        Delta = 1,        // the previous frame
+        Extrapolated = 2, // the previous frame, and for positions the linear extrapolation of the two previous frames
+    };
+
+    TrajectoryCodec (const TrajectoryHeader& header);
+
+    /// Appends the compressed form of raw, a frame laid out as described by the header (see Model::toFrame), to out
+    void encode (const std::uint8_t* raw, std::vector<std::uint8_t>& out);
+
+    /// Decodes the compressed frame at in, of which at most size bytes may be read, into raw (resized to the uncompressed frame size); other frames than
+    /// keyframes require the frames since the last keyframe to have just been decoded
+    /// Returns false if the frame is corrupted or truncated, i.e. its blocks would extend past its size, or past size
+    bool decode (const std::uint8_t* in, std::size_t size, std::vector<std::uint8_t>& raw);
+
+    /// Kind and total size of the compressed frame at in
+    static bool isKeyframe (const std::uint8_t* in) { std::uint32_t kind; std::memcpy(&kind, in + 8, sizeof(kind)); return kind == Keyframe; }
+    static std::uint64_t frameSize (const std::uint8_t* in) { std::uint64_t size; std::memcpy(&size, in + 16, sizeof(size)); return size; }
+
+};
+
+
+
+inline TrajectoryCodec::TrajectoryCodec (const TrajectoryHeader& header) : header(header) {
+    fieldCount = header.dimension + header.orientationComponents();
+    blockCount = (header.particleCount + BlockSize - 1) / BlockSize;
+    blocks.resize(blockCount);
+}
+
+template<typename Word>
+void TrajectoryCodec::encodeField (const std::uint8_t* values, const std::uint8_t* reference, const std::uint8_t* reference2, std::size_t begin, std::size_t end, std::vector<std::uint8_t>& out) {
+    const Word signBit = Word(1) << (sizeof(Word) * 8 - 1);
+    Word residuals[GroupSize];
+    Word previousValue = 0;
+    for (std::size_t group = begin; group < end; group += GroupSize) {
+        std::size_t n = std::min(GroupSize, end - group);
+
+        // zigzag-encoded differences, as unsigned integers of the same width as the values
+        Word any = 0;
+        for (std::size_t k = 0; k < GroupSize; ++k) {
+            Word residual = 0;
+            if (k < n) {
+                Word value;
+                std::memcpy(&value, values + (group + k) * sizeof(Word), sizeof(Word));
+                Word delta = Word(value - predict<Word>(reference, reference2, group + k, previousValue));
+                residual = Word((delta << 1) ^ ((delta & signBit) ? Word(~Word(0)) : Word(0)));
+                previousValue = value;
+            }
+            residuals[k] = residual;
+            any |= residual;
+        }
+
+        // bit width of the group, then its residuals packed least significant bits first
+        unsigned int width = 0;
+        while (width < sizeof(Word) * 8 && (any >> width) != 0) ++width;
+        out.push_back(std::uint8_t(width));
+        if (width == 0) continue;
+        std::size_t at = out.size();
+        out.resize(at + 4 * width);
+        std::uint8_t* packed = &out[at];
+        std::uint64_t buffer = 0;
+        unsigned int bits = 0;
+        for (std::size_t k = 0; k < GroupSize; ++k) {
+            buffer |= std::uint64_t(residuals[k]) << bits;
+            bits += width;
+            while (bits >= 8) {
+                *packed++ = std::uint8_t(buffer);
+                buffer >>= 8;
+                bits -= 8;
+            }
+        }
+    }
+}
+
+template<typename Word>
+const std::uint8_t* TrajectoryCodec::decodeField (const std::uint8_t* in, const std::uint8_t* inEnd, const std::uint8_t* reference, const std::uint8_t* reference2, std::size_t begin, std::size_t end, std::uint8_t* values) {
+    Word previousValue = 0;
+    for (std::size_t group = begin; group < end; group += GroupSize) {
+        std::size_t n = std::min(GroupSize, end - group);
+        if (in >= inEnd) return nullptr;
+        unsigned int width = *in++;
+        if (width > sizeof(Word) * 8 || std::size_t(inEnd - in) < 4 * width) return nullptr;
+        const std::uint8_t* next = in + 4 * width; // groups always take 4 * width bytes, even partial ones
+        const Word mask = width >= sizeof(Word) * 8 ? Word(~Word(0)) : Word((Word(1) << width) - 1);
+        std::uint64_t buffer = 0;
+        unsigned int bits = 0;
+        for (std::size_t k = 0; k < n; ++k) {
+            Word residual = 0;
+            if (width > 0) {
+                while (bits < width) {
+                    buffer |= std::uint64_t(*in++) << bits;
+                    bits += 8;
+                }
+                residual = Word(buffer) & mask;
+                buffer >>= width;
+                bits -= width;
+            }
+            Word delta = Word((residual >> 1) ^ Word(Word(0) - (residual & 1)));
+            Word value = Word(predict<Word>(reference, reference2, group + k, previousValue) + delta);
+            std::memcpy(values + (group + k) * sizeof(Word), &value, sizeof(Word));
+            previousValue = value;
+        }
+        in = next;
+    }
+    return in;
+}
+
+inline void TrajectoryCodec::encode (const std::uint8_t* raw, std::vector<std::uint8_t>& out) {
+    std::size_t rawSize = header.frameSize();
+    bool keyframe = previous.empty() || framesSinceKeyframe + 1 >= header.keyframeInterval;
+    bool extrapolate = !keyframe && !beforePrevious.empty();
+    const std::uint8_t* reference = keyframe ? nullptr : previous.data();
+    const std::uint8_t* reference2 = extrapolate ? beforePrevious.data() : nullptr;
+
+    // each block holds all fields of its particles, and is encoded independently of the others
+    #pragma omp parallel for schedule(dynamic)
+    for (std::size_t b = 0; b < blockCount; ++b) {
+        std::size_t begin = b * BlockSize, end = std::min<std::size_t>(header.particleCount, begin + BlockSize);
+        std::vector<std::uint8_t>& block = blocks[b];
+        block.clear();
+        for (std::size_t f = 0; f < fieldCount; ++f) {
+            const std::uint8_t* values = raw + fieldOffset(f);
+            const std::uint8_t* ref = reference != nullptr ? reference + fieldOffset(f) : nullptr;
+            const std::uint8_t* ref2 = reference2 != nullptr && isPosition(f) ? reference2 + fieldOffset(f) : nullptr;
+            if (fieldWordSize(f) == 2) encodeField<std::uint16_t>(values, ref, ref2, begin, end, block);
+            else encodeField<std::uint32_t>(values, ref, ref2, begin, end, block);
+        }
+    }
+
+    // block offsets, then blocks copied in parallel to their final location
+    std::vector<std::uint64_t> offsets(blockCount + 1);
+    offsets[0] = PreambleSize + Trajectory::align((blockCount + 1) * sizeof(std::uint64_t));
+    for (std::size_t b = 0; b < blockCount; ++b) {
+        offsets[b + 1] = offsets[b] + blocks[b].size();
+    }
+    std::uint64_t size = Trajectory::align(offsets[blockCount]);
+    std::size_t start = out.size();
+    out.resize(start + size, 0);
+    std::uint8_t* frame = &out[start];
+    std::memcpy(frame, raw, sizeof(std::uint64_t)); // step
+    std::uint32_t kind = keyframe ? Keyframe : extrapolate ? Extrapolated : Delta, count = std::uint32_t(blockCount);
+    std::memcpy(frame + 8, &kind, sizeof(kind));
+    std::memcpy(frame + 12, &count, sizeof(count));
+    std::memcpy(frame + 16, &size, sizeof(size));
+    std::memcpy(frame + PreambleSize, offsets.data(), offsets.size() * sizeof(std::uint64_t));
+    #pragma omp parallel for
+    for (std::size_t b = 0; b < blockCount; ++b) {
+        std::memcpy(frame + offsets[b], blocks[b].data(), blocks[b].size());
+    }
+
+    if (keyframe) beforePrevious.clear();
+    else beforePrevious.swap(previous);
+    previous.assign(raw, raw + rawSize);
+    framesSinceKeyframe = keyframe ? 0 : framesSinceKeyframe + 1;
+}
+
+inline bool TrajectoryCodec::decode (const std::uint8_t* in, std::size_t size, std::vector<std::uint8_t>& raw) {
+    // the preamble, offset table and blocks must all lie within the frame, and the frames it is predicted from must have been decoded
+    std::size_t rawSize = header.frameSize();
+    std::uint32_t kind, count;
+    std::size_t tableEnd = PreambleSize + (blockCount + 1) * sizeof(std::uint64_t);
+    if (size < tableEnd) return false;
+    std::memcpy(&kind, in + 8, sizeof(kind));
+    std::memcpy(&count, in + 12, sizeof(count));
+    std::uint64_t recordedSize = frameSize(in);
+    if (kind > Extrapolated || count != blockCount || recordedSize < tableEnd || recordedSize > size) return false;
+    if ((kind != Keyframe && previous.size() != rawSize) || (kind == Extrapolated && beforePrevious.size() != rawSize)) return false;
+
+    raw.assign(rawSize, 0);
+    std::memcpy(raw.data(), in, sizeof(std::uint64_t)); // step
+    const std::uint8_t* reference = kind == Keyframe ? nullptr : previous.data();
+    const std::uint8_t* reference2 = kind == Extrapolated ? beforePrevious.data() : nullptr;
+
+    const std::uint8_t* offsetTable = in + PreambleSize;
+    bool valid = true;
+    #pragma omp parallel for schedule(dynamic) reduction(&&: valid)
+    for (std::size_t b = 0; b < blockCount; ++b) {
+        std::uint64_t offset, blockEnd;
+        std::memcpy(&offset, offsetTable + b * sizeof(std::uint64_t), sizeof(offset));
+        std::memcpy(&blockEnd, offsetTable + (b + 1) * sizeof(std::uint64_t), sizeof(blockEnd));
+        if (offset < tableEnd || offset > blockEnd || blockEnd > recordedSize) {
+            valid = false;
+            continue;
+        }
+        const std::uint8_t* block = in + offset;
+        std::size_t begin = b * BlockSize, end = std::min<std::size_t>(header.particleCount, begin + BlockSize);
+        for (std::size_t f = 0; f < fieldCount && block != nullptr; ++f) {
+            std::uint8_t* values = raw.data() + fieldOffset(f);
+            const std::uint8_t* ref = reference != nullptr ? reference + fieldOffset(f) : nullptr;
+            const std::uint8_t* ref2 = reference2 != nullptr && isPosition(f) ? reference2 + fieldOffset(f) : nullptr;
+            if (fieldWordSize(f) == 2) block = decodeField<std::uint16_t>(block, in + blockEnd, ref, ref2, begin, end, values);
+            else block = decodeField<std::uint32_t>(block, in + blockEnd, ref, ref2, begin, end, values);
+        }
+        valid = valid && block != nullptr;
+    }
+    if (!valid) return false;
+
+    beforePrevious.swap(previous);
+    previous = raw;
+    return true;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "Vec.h"
+#include "VecUtils.h"
+#include "Trajectory.h"
+#include "TrajectoryCodec.h"
+
+/// Conversion of older trajectory files to the version 2 format
+class TrajectoryConverter {
+    TrajectoryConverter()=delete;
+    TrajectoryConverter(const TrajectoryConverter&)=delete;
+    TrajectoryConverter(TrajectoryConverter&&)=delete;
+public:
+
+    /// Converts a version 1 file at inPath (a sequence of self-describing frames, see Model::toBinary) to a version 2 file at outPath
+    /// header provides the encodings (including compression) and any metadata known to the caller; its dimension and particle count are taken from the input
+    static void fromVersion1 (const std::string& inPath, const std::string& outPath, TrajectoryHeader header);
+
+};
+
+
+
+inline void TrajectoryConverter::fromVersion1 (const std::string& inPath, const std::string& outPath, TrajectoryHeader header) {
+    std::FILE* in = std::fopen(inPath.c_str(), "rb");
+    if (in == nullptr) {
+        std::printf("Could not open input file %s!\n", inPath.c_str());
+        std::exit(1);
+    }
+    std::FILE* out = std::fopen(outPath.c_str(), "wb");
+    if (out == nullptr) {
+        std::printf("Could not open output file %s for writing!\n", outPath.c_str());
+        std::exit(1);
+    }
+    auto fail = [&](const char* what, std::size_t frame) {
+        std::printf("Invalid version 1 file %s at frame %ld: %s!\n", inPath.c_str(), frame, what);
+        std::exit(1);
+    };
+
+    // frames are converted one at a time, so that memory use does not depend on the length of the file
+    std::vector<std::uint8_t> data, raw;
+    std::vector<float> particle;
+    std::unique_ptr<TrajectoryCodec> codec;
+    std::vector<std::uint64_t> offsets;
+    std::uint64_t offset = 0;
+    for (std::size_t frame = 0; ; ++frame) {
+        char magic[3];
+        std::size_t got = std::fread(magic, 1, 3, in);
+        if (got == 0) break;
+        if (got != 3 || std::memcmp(magic, "AMM", 3) != 0) fail("missing AMM header", frame);
+        std::int32_t count, dimension;
+        if (std::fread(&count, sizeof(count), 1, in) != 1 || std::fread(&dimension, sizeof(dimension), 1, in) != 1) fail("truncated header", frame);
+        if (count < 0 || (dimension != 2 && dimension != 3)) fail("invalid particle count or dimension", frame);
+
+        if (frame == 0) {
+            header.dimension = dimension;
+            header.particleCount = count;
+            if (header.positions == PositionEncoding::Fixed16 && header.periodicity <= 0) {
+                std::printf("Fixed-point positions require a periodic domain size!\n");
+                std::exit(1);
+            }
+            data.clear();
+            Trajectory::writeHeader(data, header);
+            if (header.compressed()) codec.reset(new TrajectoryCodec(header));
+        } else if (std::uint32_t(dimension) != header.dimension || std::uint64_t(count) != header.particleCount) {
+            fail("particle count or dimension differs from the first frame", frame);
+        }
+
+        // v1 frames do not record the timestep; when the save cadence is known, assume frames were saved as by main.cpp, i.e. after steps 1, 1 + saveEvery, etc.
+        // (the final frame, saved at the end of the run, is numbered the same way)
+        raw.assign(header.frameSize(), 0);
+        std::uint8_t* at = raw.data();
+        Trajectory::put<std::uint64_t>(at, header.saveEvery > 0 ? 1 + frame * std::uint64_t(header.saveEvery) : 0);
+
+        particle.resize(2 * dimension);
+        for (std::int32_t i = 0; i < count; ++i) {
+            if (std::fread(particle.data(), sizeof(float), particle.size(), in) != particle.size()) fail("truncated particle data", frame);
+            for (std::int32_t d = 0; d < dimension; ++d) {
+                if (header.positions == PositionEncoding::Fixed16) {
+                    Trajectory::put<std::uint16_t>(at + header.positionsOffset(d) + i * sizeof(std::uint16_t), Trajectory::quantise(particle[d], header.periodicity));
+                } else {
+                    Trajectory::put<float>(at + header.positionsOffset(d) + i * sizeof(float), particle[d]);
+                }
+            }
+            const float* dir = &particle[dimension];
+            if (header.orientations == OrientationEncoding::Directions) {
+                for (std::int32_t d = 0; d < dimension; ++d) {
+                    Trajectory::put<float>(at + header.orientationsOffset(d) + i * sizeof(float), dir[d]);
+                }
+            } else if (header.orientations == OrientationEncoding::Angles) {
+                float angles[2];
+                if (dimension == 2) {
+                    angles[0] = VecUtils::toSpherical<2>(Vec<2>(dir[0], dir[1]))[0];
+                } else {
+                    Vec<2> rotation = VecUtils::toSpherical<3>(Vec<3>(dir[0], dir[1], dir[2]));
+                    angles[0] = rotation[0];
+                    angles[1] = rotation[1];
+                }
+                for (std::int32_t d = 0; d < dimension - 1; ++d) {
+                    Trajectory::put<float>(at + header.orientationsOffset(d) + i * sizeof(float), angles[d]);
+                }
+            }
+        }
+        std::uint8_t footer;
+        if (std::fread(&footer, 1, 1, in) != 1 || footer != 0) fail("missing footer", frame);
+
+        std::size_t frameStart = data.size();
+        if (codec) {
+            codec->encode(raw.data(), data);
+        } else {
+            data.insert(data.end(), raw.begin(), raw.end());
+        }
+        offsets.push_back(offset + frameStart);
+        if (std::fwrite(data.data(), 1, data.size(), out) != data.size()) {
+            std::printf("Error writing to output file %s!\n", outPath.c_str());
+            std::exit(1);
+        }
+        offset += data.size();
+        data.clear();
+    }
+
+    if (offsets.empty()) {
+        std::printf("Input file %s holds no frames!\n", inPath.c_str());
+        std::exit(1);
+    }
+    Trajectory::writeIndex(data, offsets);
+    if (std::fwrite(data.data(), 1, data.size(), out) != data.size()) {
+        std::printf("Error writing to output file %s!\n", outPath.c_str());
+        std::exit(1);
+    }
+    std::fclose(in);
+    std::fclose(out);
+    std::printf("Converted %ld frames of %ld particles from %s to %s\n", offsets.size(), std::size_t(header.particleCount), inPath.c_str(), outPath.c_str());
+}
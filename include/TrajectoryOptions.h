@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "Arguments.h"
+#include "Trajectory.h"
+
+/// Command-line options selecting what version 2 trajectory files store, shared by every tool writing them
+class TrajectoryOptions {
+    TrajectoryOptions()=delete;
+    TrajectoryOptions(const TrajectoryOptions&)=delete;
+    TrajectoryOptions(TrajectoryOptions&&)=delete;
+public:
+
+    /// Reads -orientation, -position-bits, -compress and -keyframe-interval into header
+    static void read (Arguments& args, TrajectoryHeader& header) {
+        std::string orientation = args.read<std::string>("orientation", "directions"); // directions, angles or none
+        if (orientation.compare("directions") == 0) header.orientations = OrientationEncoding::Directions;
+        else if (orientation.compare("angles") == 0) header.orientations = OrientationEncoding::Angles;
+        else if (orientation.compare("none") == 0) header.orientations = OrientationEncoding::None;
+        else {
+            std::printf("Invalid orientation encoding %s, use directions, angles or none!\n", orientation.c_str());
+            std::exit(1);
+        }
+        int positionBits = args.read<int>("position-bits", 32); // 32 for raw floats, 16 for fixed point relative to the periodic box
+        switch (positionBits) {
+            case 32: header.positions = PositionEncoding::Float32; break;
+            case 16: header.positions = PositionEncoding::Fixed16; break;
+            default:
+                std::printf("Invalid number of position bits %d, use 32 or 16!\n", positionBits);
+                std::exit(1);
+        }
+        if (args.read<bool>("compress", false)) { // lossless compression of frames against the previous ones
+            header.flags |= TrajectoryHeader::Compressed;
+            header.keyframeInterval = args.read<int>("keyframe-interval", 32); // a keyframe every n frames bounds the cost of seeking to a given frame
+            if (header.keyframeInterval < 1) header.keyframeInterval = 1;
+        }
+    }
+
+};
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <memory>
+#include "Trajectory.h"
+#include "TrajectoryCodec.h"
+
+/// Read-only view over one field (one component of the positions or orientations) of all particles in a frame, pointing straight into the mapped file
+/// Values are stored every stride bytes, either as floats or as 16-bit fixed point positions (decoded on access)
+class FieldView {
+
+    const std::uint8_t* base = nullptr;
+    std::size_t count = 0;
+    std::size_t stride = 0;
+    bool fixed16 = false;
+    float periodicity = 0;
+
+public:
+
+    FieldView () { }
+    FieldView (const std::uint8_t* base, std::size_t count, std::size_t stride, bool fixed16 = false, float periodicity = 0) :
+        base(base), count(count), stride(stride), fixed16(fixed16), periodicity(periodicity) { }
+
+    inline std::size_t size () const { return count; }
+    inline bool empty () const { return count == 0; }
+
+    inline float operator[] (std::size_t i) const {
+        const std::uint8_t* at = base + i * stride;
+        if (fixed16) {
+            std::uint16_t q;
+            std::memcpy(&q, at, sizeof(q));
+            return Trajectory::dequantise(q, periodicity);
+        }
+        float x;
+        std::memcpy(&x, at, sizeof(x));
+        return x;
+    }
+
+    /// Contiguous float array, when the values are stored as such (version 2 files with float fields); nullptr otherwise
+    inline const float* data () const {
+        return !fixed16 && stride == sizeof(float) ? reinterpret_cast<const float*>(base) : nullptr;
+    }
+
+};
+
+/// One frame of a trajectory file: views over each component of the particle positions and orientations
+struct TrajectoryFrame {
+    std::uint64_t step = 0; // 0 if unknown (version 1 files)
+    std::size_t particleCount = 0;
+    FieldView positions[3];
+    FieldView orientations[3]; // empty when the file does not store orientations
+};
+
+/// State needed to decode the frames of compressed files: the last decoded frame, from which the next one can be decoded in turn
+/// Readers may share a reader across threads, but each thread needs its own cursor; reading frames in increasing order is cheapest
+struct TrajectoryCursor {
+    std::unique_ptr<TrajectoryCodec> codec;
+    std::vector<std::uint8_t> raw; // last decoded frame, in the uncompressed layout
+    std::size_t decoded = SIZE_MAX;
+};
+
+/// Header-only reader for trajectory files (both version 1 and version 2, see Trajectory), which maps the file into memory rather than loading it
+/// Frames are located once when opening the file (from the index of version 2 files), then accessed in O(1) with no copy; the OS pages data in as it is read,
+/// so that files much larger than memory can be processed, and frames can be read concurrently from multiple threads
+class TrajectoryReader {
+
+    int fd = -1;
+    const std::uint8_t* data = nullptr;
+    std::size_t size = 0;
+
+    int version = 0;
+    TrajectoryHeader header;
+    std::vector<std::uint64_t> offsets;
+    std::string error;
+
+    bool openVersion2 ();
+    bool openVersion1 ();
+
+    TrajectoryFrame viewsOf (const std::uint8_t* at) const;
+
+public:
+
+    /// Maps the file at path; on failure, isOpen() returns false and getError() describes the problem
+    TrajectoryReader (const std::string& path);
+    TrajectoryReader (const TrajectoryReader&)=delete;
+    TrajectoryReader (TrajectoryReader&&)=delete;
+    ~TrajectoryReader ();
+
+    bool isOpen () const { return version != 0; }
+    const std::string& getError () const { return error; }
+
+    int getVersion () const { return version; }
+    /// Global header; for version 1 files, only the dimension, particle count and orientation encoding (directions) are known
+    const TrajectoryHeader& getHeader () const { return header; }
+    std::size_t getFrameCount () const { return offsets.size(); }
+
+    bool isCompressed () const { return version == 2 && header.compressed(); }
+
+    /// Views over frame k, valid as long as the reader is; not available for compressed files, which need a cursor
+    TrajectoryFrame frame (std::size_t k) const;
+
+    /// Views over frame k, decoding it into cursor if the file is compressed; views are then only valid until the cursor is next used
+    /// Exits with an error if a compressed frame is corrupted
+    TrajectoryFrame frame (std::size_t k, TrajectoryCursor& cursor) const;
+
+};
+
+
+
+inline TrajectoryReader::TrajectoryReader (const std::string& path) {
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "could not open " + path;
+        return;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+        error = "could not read the size of " + path + ", or it is empty";
+        return;
+    }
+    size = std::size_t(info.st_size);
+    void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        error = "could not map " + path + " into memory";
+        size = 0;
+        return;
+    }
+    data = static_cast<const std::uint8_t*>(mapped);
+
+    if (size >= 4 && std::memcmp(data, "AMM2", 4) == 0) {
+        if (openVersion2()) version = 2;
+    } else if (size >= 3 && std::memcmp(data, "AMM", 3) == 0) {
+        if (openVersion1()) version = 1;
+    } else {
+        error = path + " is not a trajectory file";
+    }
+    if (version == 0) error = "invalid file " + path + ": " + error;
+}
+
+inline TrajectoryReader::~TrajectoryReader () {
+    if (data != nullptr) ::munmap(const_cast<std::uint8_t*>(data), size);
+    if (fd >= 0) ::close(fd);
+}
+
+inline bool TrajectoryReader::openVersion2 () {
+    std::size_t headerSize;
+    if (!Trajectory::readHeader(data, size, header, headerSize)) {
+        error = "unsupported or corrupted header";
+        return false;
+    }
+    bool compressed = header.compressed();
+    auto frameSizeAt = [&](std::size_t at) -> std::size_t {
+        if (!compressed) return header.frameSize();
+        return at + TrajectoryCodec::PreambleSize <= size ? TrajectoryCodec::frameSize(data + at) : size;
+    };
+    if (!Trajectory::readIndex(data, size, offsets)) {
+        // no index, e.g. as the run was interrupted: frames have a fixed size or record their own, so can still be located
+        for (std::size_t at = headerSize; at + TrajectoryCodec::PreambleSize <= size; ) {
+            std::size_t frameSize = frameSizeAt(at);
+            if (frameSize == 0 || at + frameSize > size) break;
+            offsets.push_back(at);
+            at += frameSize;
+        }
+    }
+    if (compressed && !offsets.empty() && !TrajectoryCodec::isKeyframe(data + offsets[0])) {
+        error = "first frame is not a keyframe";
+        offsets.clear();
+        return false;
+    }
+    for (std::uint64_t offset : offsets) {
+        if (offset < headerSize || offset + TrajectoryCodec::PreambleSize > size || offset + frameSizeAt(offset) > size) {
+            error = "frame index points outside of the file";
+            offsets.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool TrajectoryReader::openVersion1 () {
+    // frames are self-describing, and may only be located by walking through their headers
+    header = TrajectoryHeader();
+    header.orientations = OrientationEncoding::Directions;
+    for (std::size_t at = 0; at < size; ) {
+        std::int32_t count, dimension;
+        if (at + 11 > size || std::memcmp(data + at, "AMM", 3) != 0) {
+            error = "missing AMM header at frame " + std::to_string(offsets.size());
+            return false;
+        }
+        std::memcpy(&count, data + at + 3, sizeof(count));
+        std::memcpy(&dimension, data + at + 7, sizeof(dimension));
+        if (count < 0 || (dimension != 2 && dimension != 3)) {
+            error = "invalid particle count or dimension at frame " + std::to_string(offsets.size());
+            return false;
+        }
+        if (offsets.empty()) {
+            header.dimension = dimension;
+            header.particleCount = count;
+        } else if (std::uint32_t(dimension) != header.dimension || std::uint64_t(count) != header.particleCount) {
+            error = "particle count or dimension changes at frame " + std::to_string(offsets.size());
+            return false;
+        }
+        std::size_t frameSize = 11 + std::size_t(count) * 2 * dimension * sizeof(float) + 1;
+        if (at + frameSize > size || data[at + frameSize - 1] != 0) {
+            error = "truncated frame " + std::to_string(offsets.size());
+            return false;
+        }
+        offsets.push_back(at);
+        at += frameSize;
+    }
+    return true;
+}
+
+inline TrajectoryFrame TrajectoryReader::frame (std::size_t k) const {
+    if (isCompressed()) {
+        std::printf("Frames of compressed trajectory files can only be read through a cursor!\n");
+        std::exit(1);
+    }
+    return viewsOf(data + offsets[k]);
+}
+
+inline TrajectoryFrame TrajectoryReader::frame (std::size_t k, TrajectoryCursor& cursor) const {
+    if (!isCompressed()) return viewsOf(data + offsets[k]);
+    if (cursor.decoded == k) return viewsOf(cursor.raw.data());
+    if (!cursor.codec) cursor.codec.reset(new TrajectoryCodec(header));
+    
+    // decode forward from the last keyframe, or from the frame the cursor already holds when it lies in between
+    std::size_t start = k;
+    while (start > 0 && !TrajectoryCodec::isKeyframe(data + offsets[start])) --start;
+    if (cursor.decoded != SIZE_MAX && cursor.decoded >= start && cursor.decoded < k) start = cursor.decoded + 1;
+    for (std::size_t j = start; j <= k; ++j) {
+        cursor.decoded = SIZE_MAX;
+        if (!cursor.codec->decode(data + offsets[j], size - offsets[j], cursor.raw)) {
+            std::printf("Compressed frame %ld is corrupted or truncated!\n", j);
+            std::exit(1);
+        }
+        cursor.decoded = j;
+    }
+    return viewsOf(cursor.raw.data());
+}
+
+inline TrajectoryFrame TrajectoryReader::viewsOf (const std::uint8_t* at) const {
+    TrajectoryFrame view;
+    std::size_t n = header.particleCount;
+    view.particleCount = n;
+    if (version == 1) {
+        // interleaved position and direction vectors of each particle
+        std::size_t stride = 2 * header.dimension * sizeof(float);
+        for (std::uint32_t d = 0; d < header.dimension; ++d) {
+            view.positions[d] = FieldView(at + 11 + d * sizeof(float), n, stride);
+            view.orientations[d] = FieldView(at + 11 + (header.dimension + d) * sizeof(float), n, stride);
+        }
+        return view;
+    }
+    std::memcpy(&view.step, at, sizeof(view.step));
+    bool fixed16 = header.positions == PositionEncoding::Fixed16;
+    for (std::uint32_t d = 0; d < header.dimension; ++d) {
+        view.positions[d] = FieldView(at + header.positionsOffset(d), n, header.positionBytes(), fixed16, header.periodicity);
+    }
+    for (std::uint32_t d = 0; d < header.orientationComponents(); ++d) {
+        view.orientations[d] = FieldView(at + header.orientationsOffset(d), n, sizeof(float));
+    }
+    return view;
+}
@@ -253,6 +253,14 @@ public:
         }
     }
 
+    /// Component-wise minimum image convention, for a displacement vector between two points within a periodic domain (centered at 0, size 2*length)
+    inline void minimumImage (const T& length) {
+        for (int i = 0; i < N; ++i) {
+            T v = get(i);
+            set(i, v > length ? v - 2*length : v < -length ? v + 2*length : v);
+        }
+    }
+
 
 	/// Assuming two Vecs representing positions in space, moves this vec towards the position of the other one, with a clamp on how far the vec may move at once
 	inline void moveTowards(const Vec<N, T>& target, const T& max) {
@@ -17,26 +17,40 @@ public:
     template<int D>
     static Vec<D-1> toSpherical (const Vec<D>& direction);
     
+    // Turns a unit direction vector by a random angular step, given D-1 standard normal draws scaled by sigma: in 2D, a rotation by that angle; in 3D,
+    // a perturbation within the plane tangent to the direction, then renormalised, which (unlike adding noise to the spherical angles) is isotropic
+    template<int D>
+    static Vec<D> turn (const Vec<D>& direction, float sigma, const float* noise);
+    
 };
 
 
 
 
 template<>
-Vec<2> VecUtils::toCartesian<2> (const Vec<1>& rotation) {
+inline Vec<2> VecUtils::toCartesian<2> (const Vec<1>& rotation) {
     return {
         std::cos(rotation.X()),
         std::sin(rotation.X())
     };
 }
 template<>
-Vec<1> VecUtils::toSpherical<2> (const Vec<2>& direction) {
+inline Vec<1> VecUtils::toSpherical<2> (const Vec<2>& direction) {
     return { std::atan2(direction.Y(), direction.X()) };
 }
+template<>
+inline Vec<2> VecUtils::turn<2> (const Vec<2>& direction, float sigma, const float* noise) {
+    float angle = sigma * noise[0];
+    float c = std::cos(angle), s = std::sin(angle);
+    return {
+        c * direction.X() - s * direction.Y(),
+        s * direction.X() + c * direction.Y()
+    };
+}
 
 
 template<>
-Vec<3> VecUtils::toCartesian<3> (const Vec<2>& rotation) {
+inline Vec<3> VecUtils::toCartesian<3> (const Vec<2>& rotation) {
     // spherical coordinates (r = 1) to cartesian coordinates
     float theta = rotation.X(); // 0..2pi
     float phi = rotation.Y(); // 0..pi
@@ -48,9 +62,23 @@ Vec<3> VecUtils::toCartesian<3> (const Vec<2>& rotation) {
     };
 }
 template<>
-Vec<2> VecUtils::toSpherical<3> (const Vec<3>& direction) {
+inline Vec<2> VecUtils::toSpherical<3> (const Vec<3>& direction) {
     return {
         std::atan2(direction.Y(), direction.X()),
         std::acos(direction.Z())
     };
 }
+template<>
+inline Vec<3> VecUtils::turn<3> (const Vec<3>& direction, float sigma, const float* noise) {
+    // orthonormal basis (e1, e2) of the tangent plane, e1 being orthogonal to the Z axis, or to the X axis when the direction is close to Z
+    // (picked through selects rather than branches, as which one applies is unpredictable from one particle to the next)
+    float x = direction.X(), y = direction.Y(), z = direction.Z();
+    bool nearZ = std::abs(z) >= 0.9f;
+    float e1x = nearZ ? 0.0f : y, e1y = nearZ ? z : -x, e1z = nearZ ? -y : 0.0f;
+    float scale = 1.0f / std::sqrt(e1x * e1x + e1y * e1y + e1z * e1z);
+    e1x *= scale; e1y *= scale; e1z *= scale;
+    float e2x = y * e1z - z * e1y, e2y = z * e1x - x * e1z, e2z = x * e1y - y * e1x;
+    float a = sigma * noise[0], b = sigma * noise[1];
+    Vec<3> turned(x + a * e1x + b * e2x, y + a * e1y + b * e2y, z + a * e1z + b * e2z);
+    return turned * (1.0f / std::sqrt(turned.lengthSqr()));
+}
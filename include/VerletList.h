@@ -0,0 +1,163 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <omp.h>
+#include "Vec.h"
+#include "BinaryIO.h"
+#include "CellList.h"
+
+/// Verlet neighbour lists: for each particle, the indices of all other particles within radius + skin at the time of the last build
+/// As long as no particle has moved further than skin / 2 since, the lists still contain every pair within radius and can be reused across timesteps
+/// Lists are stored in CSR layout, i.e. the neighbours of particle i are indices[offsets[i]] .. indices[offsets[i+1]-1]
+template<int D>
+class VerletList {
+
+    float skin;
+    bool valid = false;
+    std::size_t buildCount = 0;
+
+    std::vector<Vec<D>> referencePositions; // positions at the time of the last build
+    std::vector<std::uint32_t> offsets;
+    std::vector<std::uint32_t> indices;
+
+    template<typename PosFn>
+    bool needsRebuild (std::size_t count, PosFn position, float periodicity) const;
+
+    template<typename PosFn>
+    void build (std::size_t count, PosFn position, float radius, float periodicity, CellList<D>& cells);
+
+public:
+
+    VerletList (float skin) : skin(skin) { }
+
+    /// Rebuilds the lists if they are missing or may have become stale, using cells as scratch spatial index; returns whether a rebuild happened
+    template<typename PosFn>
+    bool update (std::size_t count, PosFn position, float radius, float periodicity, CellList<D>& cells) {
+        if (valid && !needsRebuild(count, position, periodicity)) return false;
+        build(count, position, radius, periodicity, cells);
+        return true;
+    }
+
+    /// Forces a rebuild on the next update, e.g. after particles have been moved or reordered externally
+    void invalidate () { valid = false; }
+
+    std::size_t getBuildCount () const { return buildCount; }
+
+    /// Appends the state of the lists to data: only the reference positions are stored, as the lists are a deterministic function of them
+    void save (std::vector<std::uint8_t>& data) const;
+
+    /// Restores the state written by save, rebuilding the exact same lists as when it was saved
+    void load (const std::vector<std::uint8_t>& data, std::size_t& at, float radius, float periodicity, CellList<D>& cells);
+
+    /// Calls f(std::size_t j) for each particle j in the list of particle i; this includes particles up to radius + skin away, which callers must discard
+    template<typename F>
+    void forEachCandidate (std::size_t i, F&& f) const {
+        for (std::uint32_t k = offsets[i], end = offsets[i + 1]; k < end; ++k) {
+            f(std::size_t(indices[k]));
+        }
+    }
+
+    /// Calls f(const std::uint32_t* indices, std::size_t n) once, over the whole list of particle i
+    template<typename F>
+    void forEachSlice (std::size_t i, F&& f) const {
+        f(indices.data() + offsets[i], std::size_t(offsets[i + 1] - offsets[i]));
+    }
+
+};
+
+
+
+template<int D>
+template<typename PosFn>
+bool VerletList<D>::needsRebuild (std::size_t count, PosFn position, float periodicity) const {
+    if (referencePositions.size() != count) return true;
+
+    // largest displacement of any particle since the last build
+    float maxSqr = 0.0f;
+    #pragma omp parallel for reduction(max: maxSqr)
+    for (std::size_t i = 0; i < count; ++i) {
+        Vec<D> delta = position(i) - referencePositions[i];
+        if (periodicity > 0) delta.minimumImage(periodicity);
+        maxSqr = std::max(maxSqr, delta.lengthSqr());
+    }
+
+    return maxSqr > 0.25f * skin * skin;
+}
+
+template<int D>
+template<typename PosFn>
+void VerletList<D>::build (std::size_t count, PosFn position, float radius, float periodicity, CellList<D>& cells) {
+    float listRadius = radius + skin;
+    float listRadius2 = listRadius * listRadius;
+    cells.build(count, position, listRadius, periodicity);
+
+    referencePositions.resize(count);
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < count; ++i) {
+        referencePositions[i] = position(i);
+    }
+
+    auto forEachListed = [&](std::size_t i, auto&& f) {
+        const Vec<D>& pos = referencePositions[i];
+        cells.forEachCandidate(pos, [&](std::size_t j) {
+            if (i == j) return;
+            Vec<D> delta = pos - referencePositions[j];
+            if (periodicity > 0) delta.minimumImage(periodicity);
+            if (delta.lengthSqr() <= listRadius2) f(j);
+        });
+    };
+
+    // gather each particle's neighbours into per-thread buffers in a single pass, then concatenate them in particle order
+    std::vector<std::uint32_t> owner(count), localStart(count);
+    std::vector<std::vector<std::uint32_t>> threadIndices(omp_get_max_threads());
+    offsets.assign(count + 1, 0);
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        std::vector<std::uint32_t>& local = threadIndices[t];
+        local.clear();
+        #pragma omp for
+        for (std::size_t i = 0; i < count; ++i) {
+            owner[i] = t;
+            localStart[i] = std::uint32_t(local.size());
+            forEachListed(i, [&local](std::size_t j) { local.push_back(std::uint32_t(j)); });
+            offsets[i + 1] = std::uint32_t(local.size()) - localStart[i];
+        }
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    indices.resize(offsets[count]);
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::uint32_t* src = threadIndices[owner[i]].data() + localStart[i];
+        std::copy(src, src + (offsets[i + 1] - offsets[i]), indices.data() + offsets[i]);
+    }
+
+    valid = true;
+    ++buildCount;
+}
+
+template<int D>
+void VerletList<D>::save (std::vector<std::uint8_t>& data) const {
+    BinIO::writeSimple<std::uint8_t>(data, valid ? 1 : 0);
+    BinIO::writeSimple<std::uint64_t>(data, buildCount);
+    BinIO::writeSimple<std::uint64_t>(data, referencePositions.size());
+    BinIO::writeArray(data, referencePositions.data(), referencePositions.size());
+}
+
+template<int D>
+void VerletList<D>::load (const std::vector<std::uint8_t>& data, std::size_t& at, float radius, float periodicity, CellList<D>& cells) {
+    bool wasValid = BinIO::readSimple<std::uint8_t>(data, at) != 0;
+    std::size_t builds = BinIO::readSimple<std::uint64_t>(data, at);
+    std::vector<Vec<D>> saved(BinIO::readSimple<std::uint64_t>(data, at));
+    BinIO::readArray(data, at, saved.data(), saved.size());
+    valid = false;
+    if (wasValid) {
+        build(saved.size(), [&saved](std::size_t i) { return saved[i]; }, radius, periodicity, cells);
+    }
+    buildCount = builds;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
+
+/// Fixed set of worker threads running independent tasks of uneven durations (e.g. whole simulation runs)
+/// Each worker has its own queue, which it runs from the back; a worker whose queue is empty steals from the front of the others, so that the tasks
+/// left over by long ones are taken over by the workers which finished early, without all workers contending on a single shared queue
+class WorkStealingPool {
+
+    typedef std::function<void()> Task;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::size_t nextQueue = 0; // tasks submitted from outside the pool are dealt round-robin
+
+    // queued: tasks waiting in a queue, pending: tasks submitted and not yet finished, pushed: tasks submitted so far; all guarded by stateMutex
+    std::mutex stateMutex;
+    std::condition_variable workAvailable, allDone, taskPushed;
+    std::size_t queued = 0, pending = 0, pushed = 0;
+    bool stopping = false;
+    std::atomic<std::size_t> steals{0};
+
+    // index of the worker running on the calling thread, or -1 outside the pool
+    static int& currentWorker () {
+        static thread_local int worker = -1;
+        return worker;
+    }
+
+    // takes a task from the back of worker w's queue, or else from the front of another one
+    bool take (std::size_t w, Task& task);
+
+    void work (std::size_t w, const std::function<void(std::size_t)>& onStart);
+
+public:
+
+    /// Starts the given number of workers, each calling onStart (if given) with its index before running any task
+    WorkStealingPool (std::size_t threads, const std::function<void(std::size_t)>& onStart = nullptr);
+    WorkStealingPool (const WorkStealingPool&)=delete;
+    WorkStealingPool (WorkStealingPool&&)=delete;
+
+    /// Waits for all tasks to finish, then stops the workers
+    ~WorkStealingPool ();
+
+    /// Queues a task; tasks submitted by a running task go to the back of its own worker's queue
+    void submit (const Task& task);
+
+    /// Blocks until every task submitted so far has finished
+    void wait ();
+
+    std::size_t getThreadCount () const { return workers.size(); }
+
+    /// Number of tasks run by another worker than the one they were queued on
+    std::size_t getSteals () const { return steals; }
+
+};
+
+
+
+inline WorkStealingPool::WorkStealingPool (std::size_t threads, const std::function<void(std::size_t)>& onStart) {
+    if (threads == 0) threads = 1;
+    for (std::size_t w = 0; w < threads; ++w) queues.emplace_back(new Queue());
+    for (std::size_t w = 0; w < threads; ++w) workers.emplace_back(&WorkStealingPool::work, this, w, onStart);
+}
+
+inline WorkStealingPool::~WorkStealingPool () {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+inline void WorkStealingPool::submit (const Task& task) {
+    int self = currentWorker();
+    std::size_t w;
+    if (self >= 0) {
+        w = std::size_t(self);
+    } else {
+        w = nextQueue;
+        nextQueue = (nextQueue + 1) % queues.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[w]->mutex);
+        queues[w]->tasks.push_back(task);
+    }
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        ++queued;
+        ++pending;
+        ++pushed;
+    }
+    workAvailable.notify_one();
+    taskPushed.notify_all();
+}
+
+inline void WorkStealingPool::wait () {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    allDone.wait(lock, [this] { return pending == 0; });
+}
+
+inline bool WorkStealingPool::take (std::size_t w, Task& task) {
+    {
+        std::lock_guard<std::mutex> lock(queues[w]->mutex);
+        if (!queues[w]->tasks.empty()) {
+            task = std::move(queues[w]->tasks.back());
+            queues[w]->tasks.pop_back();
+            return true;
+        }
+    }
+    for (std::size_t k = 1; k < queues.size(); ++k) {
+        Queue& victim = *queues[(w + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            ++steals;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void WorkStealingPool::work (std::size_t w, const std::function<void(std::size_t)>& onStart) {
+    currentWorker() = int(w);
+    if (onStart) onStart(w);
+    while (true) {
+        std::size_t seen;
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            workAvailable.wait(lock, [this] { return queued > 0 || stopping; });
+            if (queued == 0) return; // stopping
+            --queued; // claims one of the queued tasks, which take is then bound to find
+            seen = pushed;
+        }
+        Task task;
+        while (!take(w, task)) {
+            // another worker took the task this one would have found, while a newer one was pushed to a queue this one had already looked into:
+            // wait for that push to be counted, rather than spin, then look again
+            std::unique_lock<std::mutex> lock(stateMutex);
+            taskPushed.wait(lock, [this, seen] { return pushed != seen; });
+            seen = pushed;
+        }
+        task();
+        task = nullptr;
+
+        bool done;
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            done = --pending == 0;
+        }
+        if (done) allDone.notify_all();
+    }
+}
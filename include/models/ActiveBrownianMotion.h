@@ -9,29 +9,44 @@ class ActiveBrownianMotion : public Model<D> {
     
 protected:
     std::string getName () override { return "Active Brownian Motion"; }
-    void updateParticle (std::size_t i) override;
+    inline void updateParticle (std::size_t i);
     
 public:
     ActiveBrownianMotion (float angularDiffusion, typename Model<D>::Params params);
     
+    void update () override { this->advance([this](std::size_t i) { updateParticle(i); }); }
+    
 };
 
 
 
 template<int D>
 ActiveBrownianMotion<D>::ActiveBrownianMotion (float angularDiffusion, typename Model<D>::Params params) :
-    Model<D>(params), sqrt2Dr(std::sqrt(2.0f * angularDiffusion)) { }
+    Model<D>(params), sqrt2Dr(std::sqrt(2.0f * angularDiffusion)) {
+    this->useNoise(D-1);
+}
 
 template<int D>
 void ActiveBrownianMotion<D>::updateParticle (std::size_t i) {
     
-    // apply white noise to rotation
-    for (int d = 0; d < D-1; ++d) {
-        this->particles[i].rotation.set(d, this->particles[i].rotation.get(d) + sqrt2Dr*this->rand(std::normal_distribution<float>(0.0f, 1.0f)));
+    ParticleView<D> particle = this->particles[i];
+    const float* noise = this->noiseOf(i);
+    
+    // apply white noise to rotation, or turn the direction by it when stored as a vector
+    Vec<D> direction;
+    if (this->orientation == Orientation::Vectors) {
+        direction = VecUtils::turn<D>(particle.direction(), sqrt2Dr, noise);
+        particle.setDirection(direction);
+    } else {
+        Vec<D-1> rotation = particle.rotation();
+        for (int d = 0; d < D-1; ++d) {
+            rotation.set(d, rotation.get(d) + sqrt2Dr*noise[d]);
+        }
+        particle.setRotation(rotation);
+        direction = VecUtils::toCartesian<D>(rotation);
     }
     
     // keep running
-    Vec<D> direction = VecUtils::toCartesian<D>(this->particles[i].rotation);
-    this->particles[i].pos += direction;
+    particle.setPos(particle.pos() + direction);
     
 }
@@ -26,11 +26,14 @@ private:
     
 protected:
     std::string getName () override { return "Boids"; }
-    void updateParticle (std::size_t i) override;
+    float getInteractionRadius () override { return std::max(params.detectionRadius, params.separationRadius); }
+    inline void updateParticle (std::size_t i);
     
 public:
     Boids (Params params, typename Model<D>::Params modelParams);
     
+    void update () override { this->advance([this](std::size_t i) { updateParticle(i); }); }
+    
 };
 
 
@@ -39,63 +42,59 @@ template<int D>
 Boids<D>::Boids (Boids<D>::Params params, typename Model<D>::Params modelParams) :
         DoubleBufferedModel<D>(modelParams),
         params(params),
-        sqrt2Dr(std::sqrt(2.0f * params.angularDiffusion)) { }
+        sqrt2Dr(std::sqrt(2.0f * params.angularDiffusion)) {
+    this->useNoise(D-1);
+}
 
 template<int D>
 void Boids<D>::updateParticle (std::size_t i) {
     
     // separation, alignment and cohesion steps
-    Vec<D> pos = (*this->particlesFront)[i].pos;
-    Vec<D> dir = VecUtils::toCartesian<D>((*this->particlesFront)[i].rotation);
-    Vec<D> separation = Vec<D>::Zero();
-    Vec<D> alignment = dir;
-    Vec<D> cohesion = Vec<D>::Zero();
-    std::size_t neighbourCount = 0;
-    for (std::size_t j = 0; j < this->particleCount; ++j) {
-        if (i == j) continue;
-        const Vec<D>& otherPos = (*this->particlesFront)[j].pos;
-        float distanceSqr = (pos - otherPos).lengthSqr();
-        
-        // separation step
-        if (distanceSqr <= params.separationRadius * params.separationRadius) {
-            Vec<D> delta = pos - otherPos;
-            delta.normalize();
-            delta *= std::sqrt(distanceSqr);
-            separation += delta;
-        }
-        
-        // alignment & cohesion steps
-        if (distanceSqr <= params.detectionRadius * params.detectionRadius) {
-            alignment += VecUtils::toCartesian<D>((*this->particlesFront)[j].rotation);
-            cohesion += otherPos;
-            ++neighbourCount;
-        }
-    }
+    Vec<D> pos = this->particlesFront->pos(i);
+    Vec<D> dir = this->direction(i);
+    PairSums<D> neighbours = this->template sumNeighbours<true>(i, pos, params.detectionRadius * params.detectionRadius, params.separationRadius * params.separationRadius);
     
-    // Normalize the direction vectors
+    // separation: away from neighbours that are too close
+    Vec<D> separation = neighbours.separation;
     if (!separation.isZero()) {
         separation.normalize();
     }
+    
+    // alignment: towards the mean direction of neighbours, including this particle's own direction
+    Vec<D> alignment = dir + neighbours.direction;
     if (!alignment.isZero()) {
         alignment.normalize();
     }
-    if (!cohesion.isZero()) {
-        cohesion *= 1.0f / neighbourCount;
-        cohesion = cohesion - pos;
+    
+    // cohesion: towards the mean position of neighbours, i.e. against their mean displacement from this particle
+    Vec<D> cohesion = Vec<D>::Zero();
+    if (neighbours.count > 0) {
+        cohesion = neighbours.displacement * (-1.0f / neighbours.count);
         cohesion.normalize();
     }
     
     Vec<D> targetDirection = separation * params.separationCoeff + alignment * params.alignmentCoeff + cohesion * params.cohesionCoeff;
     Vec<D> direction = Vec<D>::Lerp(dir, targetDirection, params.adoptionRate);
-    Vec<D-1> rotation = VecUtils::toSpherical<D>(direction);
+    const float* noise = this->noiseOf(i);
     
-    // apply white noise to rotation
-    for (int d = 0; d < D-1; ++d) {
-        rotation.set(d, rotation.get(d) + sqrt2Dr*this->rand(std::normal_distribution<float>(0.0f, 1.0f)));
+    if (this->orientation == Orientation::Vectors) {
+        // turn the new direction by white noise, or the previous direction if the new one is exactly 0
+        if (!direction.normalize()) {
+            direction = dir;
+        }
+        direction = VecUtils::turn<D>(direction, sqrt2Dr, noise);
+        this->particlesBack->setDirection(i, direction);
+    } else {
+        Vec<D-1> rotation = VecUtils::toSpherical<D>(direction);
+        
+        // apply white noise to rotation
+        for (int d = 0; d < D-1; ++d) {
+            rotation.set(d, rotation.get(d) + sqrt2Dr*noise[d]);
+        }
+        direction = VecUtils::toCartesian<D>(rotation);
+        this->particlesBack->setRotation(i, rotation);
     }
-    direction = VecUtils::toCartesian<D>(rotation);
     
     // update back buffer
-    (*this->particlesBack)[i].rotation = rotation;
-    (*this->particlesBack)[i].pos = pos + direction;
+    this->particlesBack->setPos(i, pos + direction);
 }
@@ -1,6 +1,24 @@
 #pragma once
 
+#include <functional>
 #include "models/Model.h"
+#include "CellList.h"
+#include "VerletList.h"
+#include "PairKernels.h"
+#include "SpatialSort.h"
+
+/// Exchange of particles with other processes, when the domain is split across them (see DomainDecomposition)
+template<int D>
+class ParticleExchange {
+public:
+    virtual ~ParticleExchange () { }
+    
+    /// Sends away the particles of store which left the subdomain of this process, and appends those which entered it, along with their global indices
+    virtual void migrate (ParticleStore<D>& store, std::vector<std::uint64_t>& ids) = 0;
+    
+    /// Appends copies of the particles of other processes lying within radius of this subdomain (the halo), with positions shifted to be contiguous with it
+    virtual void addHalo (ParticleStore<D>& store, float radius) = 0;
+};
 
 template<int D>
 class DoubleBufferedModel : public Model<D> {
@@ -8,11 +26,102 @@ class DoubleBufferedModel : public Model<D> {
 protected:
     
     // double-buffered implementation, to allow for reading the data from the previous timestep unimpeded
-    std::vector<Particle<D>> heldParticles;
-    std::vector<Particle<D>>* particlesFront, * particlesBack;
+    ParticleStore<D> heldParticles;
+    ParticleStore<D>* particlesFront, * particlesBack;
+    
+    // spatial index over the front buffer, rebuilt at the start of each timestep for models that interact with their neighbours
+    CellList<D> cells;
+    
+    // optional neighbour lists, reused across timesteps instead of querying the cells every step (enabled when neighbourSkin > 0)
+    VerletList<D> verlet;
+    bool useVerlet;
+    
+    // when distributed, exchanges particles with the other processes at the start of each timestep
+    // the front buffer then holds the particles of this process (particleCount of them), followed by haloCount read-only copies of neighbouring ones
+    ParticleExchange<D>* exchange = nullptr;
+    std::size_t haloCount = 0;
+    
+    // particles are sorted in memory along a space-filling curve every reorderEvery timesteps (never when 0), so that the neighbours read while
+    // updating a particle mostly lie next to it in memory, and next to those read for the previous particle
+    unsigned int reorderEvery;
+    SpatialSort<D> sorter;
+    ParticleStore<D> scratch;
+    
+    // unit direction vector of each particle in the front buffer, filled in by the prepare phase at the start of each timestep
+    // stored as one array per component, like the particle data itself; unused when the particles store their directions themselves (see Orientation)
+    AlignedVector<float> directions[D];
+    
+    // compact copies of the front buffer which the neighbour loops read instead, when compactBits is 16 or 32 (see PairQuery): positions as fixed
+    // point spanning the periodic box, in compactBits bits, and unit directions as 16-bit fixed point, which then replace the float directions
+    // they halve the data gathered for each neighbour with 16 bits (in 2D, 8 bytes instead of 16), while all arithmetic still happens in floats
+    // each array holds one more element than there are particles, as 16-bit values are gathered as the low half of 32-bit words
+    unsigned int compactBits;
+    AlignedVector<std::int32_t> fixed32[D];
+    AlignedVector<std::int16_t> fixed16[D];
+    AlignedVector<std::int16_t> fixedDirections[D];
+    
+    inline Vec<D> direction (std::size_t i) const {
+        Vec<D> dir;
+        if (compactBits > 0) {
+            for (int d = 0; d < D; ++d) dir.set(d, float(fixedDirections[d][i]) * PairKernels::DirectionStep);
+        } else {
+            for (int d = 0; d < D; ++d) dir.set(d, directionsOf(*particlesFront, d)[i]);
+        }
+        return dir;
+    }
+    
+    // array of the direction components d of the particles in store, i.e. the directions it stores, or else those filled in by the prepare phase
+    inline const AlignedVector<float>& directionsOf (const ParticleStore<D>& store, int d) const {
+        return this->orientation == Orientation::Vectors ? store.directions[d] : directions[d];
+    }
+    
+    // registers a per-particle stage to run during the prepare phase of each timestep, before any particle is updated
+    // stages run in registration order for a given particle, and may only read the front buffer and write data owned by that particle
+    void addPrepareStage (std::function<void(std::size_t)> stage) {
+        prepareStages.push_back(stage);
+    }
+    
+    // radius within which particles interact with each other; 0 for models that do not need the neighbour search
+    virtual float getInteractionRadius () { return 0.0f; }
+    
+    // calls f(std::size_t j) for each potential neighbour j of particle i, located at pos in the front buffer
+    // candidates may lie further than the interaction radius, so callers must still check distances
+    template<typename F>
+    void forEachCandidate (std::size_t i, const Vec<D>& pos, F&& f) {
+        if (useVerlet) {
+            verlet.forEachCandidate(i, f);
+        } else {
+            cells.forEachCandidate(pos, f);
+        }
+    }
+    
+    // sums the contributions of all neighbours of particle i within sqrt(radius2) (and within sqrt(separation2) for the separation sum) using the pair kernels
+    // when Full is false, only the neighbour count and direction sum are computed
+    template<bool Full>
+    PairSums<D> sumNeighbours (std::size_t i, const Vec<D>& pos, float radius2, float separation2 = -1.0f);
+    
+    const ParticleStore<D>& currentParticles () const override { return *particlesFront; }
+    
+    // sums the contributions of the candidates of particle i to query, with positions and directions read as P
+    template<bool Full, typename P>
+    PairSums<D> accumulateNeighbours (std::size_t i, const Vec<D>& pos, const PairQuery<D, P>& query);
+    
+    // sumNeighbours over the compact copies, with positions held in fixed
+    template<bool Full, typename P>
+    PairSums<D> sumCompact (std::size_t i, const Vec<D>& pos, float radius2, float separation2, const AlignedVector<P>* fixed);
+    
+    // one timestep: prepare phase, then updateParticle(i) into the back buffer for each particle that is not frozen (see Model::advance)
+    template<typename F>
+    void advance (F&& updateParticle);
     
 private:
     
+    std::vector<std::function<void(std::size_t)>> prepareStages;
+    
+    void exchangeParticles ();
+    void reorder ();
+    void prepare ();
+    
     void swapBuffers () {
         auto* oldBack = particlesBack;
         particlesBack = particlesFront;
@@ -20,47 +129,260 @@ private:
     }
     
 public:
-    DoubleBufferedModel (typename Model<D>::Params params) : Model<D>(params) {
+    DoubleBufferedModel (typename Model<D>::Params params) : Model<D>(params), verlet(params.neighbourSkin), useVerlet(params.neighbourSkin > 0),
+            reorderEvery(params.reorderEvery), compactBits(params.compactBits) {
         
-        heldParticles = std::vector<Particle<D>>(this->particleCount);
+        heldParticles.setOrientationStorage(this->orientation);
+        heldParticles.resize(this->particleCount);
         particlesFront = &this->particles;
         particlesBack = &heldParticles;
+        
+        if (compactBits > 0) {
+            if (this->periodicity <= 0) {
+                std::printf("Compact neighbour data requires a periodic domain!\n");
+                std::exit(1);
+            }
+            for (int d = 0; d < D; ++d) {
+                if (compactBits == 32) {
+                    fixed32[d].resize(this->particleCount + 1);
+                } else {
+                    fixed16[d].resize(this->particleCount + 1);
+                }
+                fixedDirections[d].resize(this->particleCount + 1);
+            }
+            addPrepareStage([this](std::size_t i) {
+                Vec<D> dir = particlesFront->direction(i);
+                for (int d = 0; d < D; ++d) {
+                    float x = particlesFront->positions[d][i];
+                    if (compactBits == 32) {
+                        fixed32[d][i] = PairKernels::toFixed<std::int32_t>(x, this->periodicity);
+                    } else {
+                        fixed16[d][i] = PairKernels::toFixed<std::int16_t>(x, this->periodicity);
+                    }
+                    fixedDirections[d][i] = PairKernels::directionToFixed(dir[d]);
+                }
+            });
+        } else if (this->orientation == Orientation::Angles) {
+            for (int d = 0; d < D; ++d) directions[d].resize(this->particleCount);
+            addPrepareStage([this](std::size_t i) {
+                Vec<D> dir = VecUtils::toCartesian<D>(particlesFront->rotation(i));
+                for (int d = 0; d < D; ++d) directions[d][i] = dir[d];
+            });
+        }
+    }
+    
+    /// Distributes the particles across processes through exchange, which must outlive the model; the domain must be periodic, without Verlet lists
+    void setExchange (ParticleExchange<D>* exchange) {
+        if (useVerlet) {
+            std::printf("Verlet lists are not supported when particles are distributed across processes!\n");
+            std::exit(1);
+        }
+        if (compactBits > 0) {
+            std::printf("Compact neighbour data is not supported when particles are distributed across processes!\n");
+            std::exit(1);
+        }
+        if (this->orientation != Orientation::Angles) {
+            std::printf("Orientations must be stored as angles when particles are distributed across processes!\n");
+            std::exit(1);
+        }
+        this->exchange = exchange;
     }
     
     virtual float getMSD () override;
     virtual void print () override;
-    virtual void update () override;
+    void saveState (std::vector<std::uint8_t>& data) override;
+    void loadState (const std::vector<std::uint8_t>& data, std::size_t& at) override;
     
 };
 
 
 template<int D>
 float DoubleBufferedModel<D>::getMSD () {
+    PROFILE_SCOPE("getMSD");
     float sum = 0.0f;
     
     #pragma omp parallel for reduction(+: sum)
     for (std::size_t i = 0; i < this->particleCount; ++i) {
-        sum += (*particlesFront)[i].pos.lengthSqr();
+        sum += particlesFront->pos(i).lengthSqr();
     }
     
     return sum / this->particleCount;
 }
 
 template<int D>
-void DoubleBufferedModel<D>::update () {
+template<bool Full>
+PairSums<D> DoubleBufferedModel<D>::sumNeighbours (std::size_t i, const Vec<D>& pos, float radius2, float separation2) {
+    if (compactBits == 32) return sumCompact<Full>(i, pos, radius2, separation2, fixed32);
+    if (compactBits == 16) return sumCompact<Full>(i, pos, radius2, separation2, fixed16);
+    
+    PairQuery<D> query;
+    for (int d = 0; d < D; ++d) {
+        query.positions[d] = particlesFront->positions[d].data();
+        query.directions[d] = directionsOf(*particlesFront, d).data();
+        query.pos[d] = pos[d];
+    }
+    query.self = std::uint32_t(i);
+    query.radius2 = radius2;
+    query.separation2 = separation2;
+    // halo copies are shifted next to the subdomain rather than wrapped around the box, so distances need no periodic image then
+    query.halfBox = this->periodicity > 0 && exchange == nullptr ? this->periodicity : std::numeric_limits<float>::infinity();
+    return accumulateNeighbours<Full>(i, pos, query);
+}
+
+template<int D>
+template<bool Full, typename P>
+PairSums<D> DoubleBufferedModel<D>::sumCompact (std::size_t i, const Vec<D>& pos, float radius2, float separation2, const AlignedVector<P>* fixed) {
+    PairQuery<D, P> query;
+    for (int d = 0; d < D; ++d) {
+        query.positions[d] = fixed[d].data();
+        query.directions[d] = fixedDirections[d].data();
+        query.pos[d] = fixed[d][i];
+    }
+    query.self = std::uint32_t(i);
+    query.radius2 = radius2;
+    query.separation2 = separation2;
+    query.halfBox = this->periodicity;
+    query.positionScale = PairKernels::fixedStep<P>(this->periodicity);
+    query.directionScale = PairKernels::DirectionStep;
+    return accumulateNeighbours<Full>(i, pos, query);
+}
+
+template<int D>
+template<bool Full, typename P>
+PairSums<D> DoubleBufferedModel<D>::accumulateNeighbours (std::size_t i, const Vec<D>& pos, const PairQuery<D, P>& query) {
+    PairLanes<D> lanes;
+    lanes.clear();
+    auto accumulate = [&](const std::uint32_t* indices, std::size_t n) {
+        PairKernels::accumulate<D, Full>(query, indices, n, lanes);
+    };
+    if (useVerlet) {
+        verlet.forEachSlice(i, accumulate);
+    } else {
+        cells.forEachCell(pos, accumulate);
+    }
+    return PairKernels::reduce(lanes);
+}
+
+template<int D>
+void DoubleBufferedModel<D>::exchangeParticles () {
+    PROFILE_SCOPE("exchange");
+    exchange->migrate(*particlesFront, this->particleIds);
+    this->particleCount = particlesFront->size();
+    float radius = getInteractionRadius();
+    if (radius > 0) exchange->addHalo(*particlesFront, radius);
+    haloCount = particlesFront->size() - this->particleCount;
+    
+    // only the particles of this process are updated into the back buffer, while per-particle data derived in the prepare phase covers the halo too
+    particlesBack->resize(this->particleCount);
+    for (int d = 0; d < D; ++d) directions[d].resize(particlesFront->size());
+}
+
+template<int D>
+void DoubleBufferedModel<D>::reorder () {
+    PROFILE_SCOPE("reorder");
+    std::size_t count = this->particleCount;
+    float radius = getInteractionRadius();
+    const std::vector<std::uint32_t>& order = sorter.sort(count, [this](std::size_t i) { return particlesFront->pos(i); }, radius > 0 ? radius : 1.0f);
+    
+    // both buffers are permuted, as the back one still holds the data of frozen particles, along with everything else indexed by particle
+    particlesFront->permute(order, scratch);
+    particlesBack->permute(order, scratch);
+    
+    // particles keep their original (or global) index, from which they draw their random numbers and at which outputs report them
+    std::vector<std::uint64_t> sortedIds(count);
     #pragma omp parallel for
-    for (std::size_t i = 0; i < this->particleCount; ++i) {
-        if ((*particlesFront)[i].frozen) {
-            (*particlesBack)[i].frozen = true;
-            continue;
+    for (std::size_t j = 0; j < count; ++j) sortedIds[j] = this->particleId(order[j]);
+    this->particleIds.swap(sortedIds);
+    
+    if (this->tracking) {
+        for (int d = 0; d < D; ++d) {
+            AlignedVector<std::int32_t> sortedImages(count);
+            AlignedVector<float> sortedOrigins(count);
+            #pragma omp parallel for
+            for (std::size_t j = 0; j < count; ++j) {
+                sortedImages[j] = this->images[d][order[j]];
+                sortedOrigins[j] = this->origins[d][order[j]];
+            }
+            this->images[d].swap(sortedImages);
+            this->origins[d].swap(sortedOrigins);
         }
-        
-        // update single particle
-        this->updateParticle(i);
-        
-        this->postProcess(&(*particlesBack)[i]);
     }
     
+    // neighbour lists hold indices, which no longer match
+    verlet.invalidate();
+}
+
+template<int D>
+void DoubleBufferedModel<D>::prepare () {
+    #pragma omp parallel
+    {
+        PROFILE_SCOPE("prepare");
+        #pragma omp for nowait
+        for (std::size_t i = 0; i < this->particleCount + haloCount; ++i) {
+            for (const auto& stage : prepareStages) {
+                stage(i);
+            }
+        }
+    }
+}
+
+template<int D>
+template<typename F>
+void DoubleBufferedModel<D>::advance (F&& updateParticle) {
+    ++this->step;
+    
+    // prepare phase: reorder particles if due, exchange particles with other processes if distributed, draw this timestep's noise, build the
+    // neighbour search structures, and cache per-particle data derived from the front buffer
+    if (reorderEvery > 0 && (this->step - 1) % reorderEvery == 0) {
+        reorder();
+    }
+    if (exchange != nullptr) {
+        exchangeParticles();
+    }
+    {
+        PROFILE_SCOPE("noise");
+        this->prepareNoise();
+    }
+    float radius = getInteractionRadius();
+    if (radius > 0) {
+        PROFILE_SCOPE("neighbour search");
+        auto position = [this](std::size_t i) { return particlesFront->pos(i); };
+        if (useVerlet) {
+            verlet.update(this->particleCount, position, radius, this->periodicity, cells);
+        } else {
+            // when distributed, the grid only spans this subdomain and its halo, which do not wrap around
+            cells.build(this->particleCount + haloCount, position, radius, exchange == nullptr ? this->periodicity : 0.0f);
+        }
+    }
+    prepare();
+    
+    // interact phase: update each particle into the back buffer (timed per thread, like the prepare phase), accumulating observables if requested
+    bool observing = this->observeNext && this->tracking;
+    this->observeNext = false;
+    if (observing) this->beginObservables();
+    auto imageCounters = this->imageArrays();
+    Boundary::dispatch<D>(this->periodicity, this->wall, [&](auto policy) {
+        #pragma omp parallel
+        {
+            PROFILE_SCOPE("interact");
+            ObservableSums sums;
+            #pragma omp for nowait
+            for (std::size_t i = 0; i < this->particleCount; ++i) {
+                if (particlesFront->frozen(i)) {
+                    particlesBack->setFrozen(i, true);
+                } else {
+                    // update single particle
+                    updateParticle(i);
+                    
+                    policy.apply((*particlesBack)[i], this->periodicity, this->boundary, imageCounters.get());
+                }
+                if (observing) this->observe(sums, *particlesBack, i);
+            }
+            if (observing) this->threadSums[omp_get_thread_num()] = sums;
+        }
+    });
+    if (observing) this->finishObservables();
+    
     // bring back buffer to front for next timestep
     swapBuffers();
 }
@@ -68,10 +390,29 @@ void DoubleBufferedModel<D>::update () {
 template<int D>
 void DoubleBufferedModel<D>::print () {
     std::printf("%s, %ld particles:\n", this->getName().c_str(), this->particleCount);
-    for (std::size_t i = 0, sz = this->particleCount > 10 ? 10 : this->particleCount; i < sz; ++i) {
-        std::printf("\t- (%ld) %s\n", i, (*particlesFront)[i].pos.toString().c_str());
+    std::size_t shown[10];
+    std::size_t sz = this->firstOutputs(shown);
+    for (std::size_t k = 0; k < sz; ++k) {
+        std::printf("\t- (%ld) %s\n", k, particlesFront->pos(shown[k]).toString().c_str());
     }
     if (this->particleCount > 10) std::printf("\t- ... (only first 10 shown)\n");
     std::printf("MSD: %f\n", getMSD());
     std::printf("\n");
 }
+
+template<int D>
+void DoubleBufferedModel<D>::saveState (std::vector<std::uint8_t>& data) {
+    // the back buffer is saved too, as it still holds the data of frozen particles, which are not rewritten at each timestep
+    Model<D>::saveState(data);
+    particlesBack->save(data);
+    verlet.save(data);
+}
+
+template<int D>
+void DoubleBufferedModel<D>::loadState (const std::vector<std::uint8_t>& data, std::size_t& at) {
+    Model<D>::loadState(data, at);
+    particlesFront = &this->particles;
+    particlesBack = &heldParticles;
+    particlesBack->load(data, at);
+    verlet.load(data, at, getInteractionRadius(), this->periodicity, cells);
+}
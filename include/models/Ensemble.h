@@ -0,0 +1,259 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <omp.h>
+#include "models/Model.h"
+
+// Independent replicas of a model, differing only by their seeds, stepped together
+// Replicas are updated concurrently, one per thread: with few particles per replica, this keeps every core busy where the parallel loops over particles
+// would mostly pay for forking and joining threads; when there are fewer replicas than threads and enough particles, the remaining threads
+// are spread over the particle loops of each replica (nested parallelism)
+// Outputs merge all replicas into one set of replicas * N particles, replica r holding particles r * N .. (r + 1) * N - 1
+class Ensemble : public ModelBase {
+    
+    std::vector<ModelBase*> replicas;
+    std::size_t particlesPerReplica;
+    int outerThreads, innerThreads;
+    
+    // ensemble statistics of the MSD at each saved frame, see recordObservables
+    struct Observables {
+        std::uint64_t step;
+        double mean, stddev;
+    };
+    std::vector<Observables> observables;
+    
+    // fewest particles per thread worth splitting a replica's particle loops for
+    static constexpr std::size_t MinParticlesPerThread = 4096;
+    
+public:
+    
+    /// Seed of replica r of an ensemble with the given seed, drawn from a dedicated random stream so that ensembles with different seeds do not share replicas
+    static std::uint32_t replicaSeed (std::uint32_t seed, std::size_t r) {
+        std::uint32_t w[4];
+        Philox::words(w, seed, Philox::Seed, r, 0, 0);
+        return w[0];
+    }
+    
+    /// Takes ownership of replicas, which must all hold the same number of particles
+    Ensemble (unsigned int seed, const std::vector<ModelBase*>& replicas);
+    Ensemble (const Ensemble&)=delete;
+    Ensemble (Ensemble&&)=delete;
+    
+    ~Ensemble ();
+    
+    std::size_t getReplicaCount () const { return replicas.size(); }
+    
+    void update () override;
+    std::size_t getParticleCount () const override { return replicas.size() * particlesPerReplica; }
+    float getMSD () override; // mean over replicas
+    void print () override;
+    void toBinary (std::vector<std::uint8_t>& data) override;
+    void toBinaryParticles (std::uint8_t* out) override;
+    void describe (TrajectoryHeader& header) override;
+    void toFrame (std::vector<std::uint8_t>& data, const TrajectoryHeader& header) override;
+    void saveState (std::vector<std::uint8_t>& data) override;
+    void loadState (const std::vector<std::uint8_t>& data, std::size_t& at) override;
+    
+    // observables of the ensemble are the means of those of its replicas
+    bool enableObservables () override;
+    void observeNextUpdate () override;
+    
+    /// Records the mean and standard deviation of the MSD across replicas at the current timestep
+    void recordObservables ();
+    
+    /// Writes the recorded observables as CSV; they are part of the saved state, so a resumed run still writes those of the interrupted run
+    void writeObservables (const std::string& path) const;
+    
+};
+
+
+
+inline Ensemble::Ensemble (unsigned int seed, const std::vector<ModelBase*>& replicas) : ModelBase(seed), replicas(replicas) {
+    particlesPerReplica = replicas[0]->getParticleCount();
+    
+    int threads = omp_get_max_threads();
+    outerThreads = int(std::min<std::size_t>(replicas.size(), threads));
+    innerThreads = std::max(1, std::min(threads / outerThreads, int(particlesPerReplica / MinParticlesPerThread)));
+    if (innerThreads > 1) {
+        omp_set_max_active_levels(2);
+    }
+}
+
+inline Ensemble::~Ensemble () {
+    for (ModelBase* replica : replicas) delete replica;
+}
+
+inline void Ensemble::update () {
+    ++step;
+    PROFILE_SCOPE("replicas");
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(outerThreads)
+    for (std::size_t r = 0; r < replicas.size(); ++r) {
+        omp_set_num_threads(innerThreads);
+        replicas[r]->update();
+    }
+    if (observeNext) {
+        observeNext = false;
+        observed = ObservableSample();
+        observed.step = step;
+        for (ModelBase* replica : replicas) {
+            const ObservableSample& sample = replica->getObservables();
+            observed.particles += sample.particles;
+            observed.msd += sample.msd / replicas.size();
+            observed.polar += sample.polar / replicas.size();
+            observed.nematic += sample.nematic / replicas.size();
+            observed.frozen += sample.frozen / replicas.size();
+        }
+    }
+}
+
+inline float Ensemble::getMSD () {
+    double sum = 0;
+    for (ModelBase* replica : replicas) sum += replica->getMSD();
+    return float(sum / replicas.size());
+}
+
+inline void Ensemble::print () {
+    std::vector<double> msds;
+    for (ModelBase* replica : replicas) msds.push_back(replica->getMSD());
+    double mean = 0, sumSqr = 0;
+    for (double msd : msds) mean += msd / msds.size();
+    for (double msd : msds) sumSqr += (msd - mean) * (msd - mean);
+    double stddev = msds.size() > 1 ? std::sqrt(sumSqr / (msds.size() - 1)) : 0.0;
+    
+    TrajectoryHeader header;
+    replicas[0]->describe(header);
+    std::printf("%s, ensemble of %ld replicas of %ld particles (%d replicas at a time, %d threads each):\n", header.model.c_str(), replicas.size(),
+        particlesPerReplica, outerThreads, innerThreads);
+    std::printf("MSD: %f +- %f (standard error), standard deviation %f, range [%f, %f]\n", mean, stddev / std::sqrt(double(msds.size())), stddev,
+        *std::min_element(msds.begin(), msds.end()), *std::max_element(msds.begin(), msds.end()));
+    std::printf("\n");
+}
+
+inline void Ensemble::toBinary (std::vector<std::uint8_t>& data) {
+    // a single version 1 frame, whose particles are those of all replicas in turn, sized once up front
+    const std::size_t headerSize = 3 + 2 * sizeof(std::int32_t);
+    TrajectoryHeader header;
+    replicas[0]->describe(header);
+    const std::size_t particlesSize = getParticleCount() * 2 * header.dimension * sizeof(float);
+    std::size_t start = data.size();
+    data.resize(start + headerSize + particlesSize + 1);
+    std::uint8_t* frame = &data[start];
+    
+    std::memcpy(frame, "AMM", 3);
+    std::int32_t counts[2] = { std::int32_t(getParticleCount()), std::int32_t(header.dimension) };
+    std::memcpy(frame + 3, counts, sizeof(counts));
+    toBinaryParticles(frame + headerSize);
+    frame[headerSize + particlesSize] = 0;
+}
+
+inline void Ensemble::toBinaryParticles (std::uint8_t* out) {
+    // each replica writes its particles straight into its own slice, in parallel
+    TrajectoryHeader header;
+    replicas[0]->describe(header);
+    const std::size_t particlesSize = particlesPerReplica * 2 * header.dimension * sizeof(float); // bytes of the particles of one replica
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(outerThreads)
+    for (std::size_t r = 0; r < replicas.size(); ++r) {
+        omp_set_num_threads(innerThreads);
+        replicas[r]->toBinaryParticles(out + r * particlesSize);
+    }
+}
+
+inline void Ensemble::describe (TrajectoryHeader& header) {
+    replicas[0]->describe(header);
+    header.particleCount = getParticleCount();
+    header.seed = getSeed();
+}
+
+inline void Ensemble::toFrame (std::vector<std::uint8_t>& data, const TrajectoryHeader& header) {
+    TrajectoryHeader single = header;
+    single.particleCount = particlesPerReplica;
+    std::size_t start = data.size();
+    data.resize(start + header.frameSize(), 0);
+    std::memcpy(&data[start], &step, sizeof(step));
+    
+    // each replica lays out its own frame, whose arrays are then copied into their slice of the merged arrays
+    #pragma omp parallel num_threads(outerThreads)
+    {
+        std::vector<std::uint8_t> frame;
+        #pragma omp for schedule(dynamic, 1)
+        for (std::size_t r = 0; r < replicas.size(); ++r) {
+            omp_set_num_threads(innerThreads);
+            frame.clear();
+            replicas[r]->toFrame(frame, single);
+            std::uint8_t* merged = &data[start];
+            std::size_t positionsSize = particlesPerReplica * header.positionBytes(), orientationsSize = particlesPerReplica * sizeof(float);
+            for (std::uint32_t d = 0; d < header.dimension; ++d) {
+                std::memcpy(merged + header.positionsOffset(d) + r * positionsSize, frame.data() + single.positionsOffset(d), positionsSize);
+            }
+            for (std::uint32_t d = 0; d < header.orientationComponents(); ++d) {
+                std::memcpy(merged + header.orientationsOffset(d) + r * orientationsSize, frame.data() + single.orientationsOffset(d), orientationsSize);
+            }
+        }
+    }
+}
+
+inline void Ensemble::saveState (std::vector<std::uint8_t>& data) {
+    BinIO::writeSimple<std::uint64_t>(data, replicas.size());
+    BinIO::writeSimple<std::uint64_t>(data, step);
+    BinIO::writeSimple<std::uint64_t>(data, observables.size());
+    BinIO::writeArray(data, observables.data(), observables.size());
+    for (ModelBase* replica : replicas) replica->saveState(data);
+}
+
+inline void Ensemble::loadState (const std::vector<std::uint8_t>& data, std::size_t& at) {
+    std::uint64_t count = BinIO::readSimple<std::uint64_t>(data, at);
+    if (count != replicas.size()) {
+        std::printf("Checkpoint holds %ld replicas, but the ensemble has %ld!\n", std::size_t(count), replicas.size());
+        std::exit(1);
+    }
+    step = BinIO::readSimple<std::uint64_t>(data, at);
+    observables.resize(BinIO::readSimple<std::uint64_t>(data, at));
+    BinIO::readArray(data, at, observables.data(), observables.size());
+    for (ModelBase* replica : replicas) replica->loadState(data, at);
+}
+
+inline bool Ensemble::enableObservables () {
+    for (ModelBase* replica : replicas) {
+        if (!replica->enableObservables()) return false;
+    }
+    return true;
+}
+
+inline void Ensemble::observeNextUpdate () {
+    observeNext = true;
+    for (ModelBase* replica : replicas) replica->observeNextUpdate();
+}
+
+inline void Ensemble::recordObservables () {
+    std::vector<double> msds(replicas.size());
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(outerThreads)
+    for (std::size_t r = 0; r < replicas.size(); ++r) {
+        omp_set_num_threads(innerThreads);
+        msds[r] = replicas[r]->getMSD();
+    }
+    Observables o;
+    o.step = step;
+    o.mean = 0;
+    for (double msd : msds) o.mean += msd / msds.size();
+    double sumSqr = 0;
+    for (double msd : msds) sumSqr += (msd - o.mean) * (msd - o.mean);
+    o.stddev = msds.size() > 1 ? std::sqrt(sumSqr / (msds.size() - 1)) : 0.0;
+    observables.push_back(o);
+}
+
+inline void Ensemble::writeObservables (const std::string& path) const {
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::printf("Could not open %s for writing!\n", path.c_str());
+        return;
+    }
+    std::fprintf(file, "step,replicas,msd_mean,msd_stddev,msd_stderr\n");
+    for (const Observables& o : observables) {
+        std::fprintf(file, "%lu,%ld,%.9g,%.9g,%.9g\n", o.step, replicas.size(), o.mean, o.stddev, o.stddev / std::sqrt(double(replicas.size())));
+    }
+    std::fclose(file);
+}
@@ -1,11 +1,16 @@
 #pragma once
 
-#include <random>
-#include <functional>
-#include <thread>
+#include <cstdint>
+#include <omp.h>
 #include "Vec.h"
 #include "VecUtils.h"
 #include "BinaryIO.h"
+#include "ParticleStore.h"
+#include "Philox.h"
+#include "Trajectory.h"
+#include "Profiler.h"
+#include "Boundary.h"
+#include "Observables.h"
 
 // Base, non-templated class exposing the APIs available to operate on the various models
 class ModelBase {
@@ -13,37 +18,84 @@ class ModelBase {
     unsigned int seed;
     
 protected:
-    // thread-safe random number generator
-    // note: depending on inconsistencies in thread scheduling, re-using the same seed might still produce different results even on the same hardware
-    template<typename distribution_t = std::uniform_real_distribution<float>>
-    float rand (distribution_t distribution) {
-        static thread_local std::mt19937 gen(seed + std::hash<std::thread::id>{}(std::this_thread::get_id()));
-        return distribution(gen);
+    // index of the current timestep; 0 while setting up the initial state, then incremented at the start of each update
+    std::uint64_t step = 0;
+    
+    // global index of each particle held, when particles are distributed across processes (see DomainDecomposition), or original index of each particle,
+    // once particles have been reordered in memory (see DoubleBufferedModel::reorder); empty otherwise, as particle i is then particle i
+    // random draws are keyed on these indices, so that a particle draws the same numbers whichever process holds it, and wherever it is stored
+    std::vector<std::uint64_t> particleIds;
+    
+    inline std::uint64_t particleId (std::size_t i) const { return particleIds.empty() ? std::uint64_t(i) : particleIds[i]; }
+    
+    // counter-based random numbers: each draw only depends on the seed, the particle index, the timestep and the draw index
+    // results are thus bit-reproducible for a given seed, whatever the number of threads or the order in which particles are updated
+    // draws are numbered independently per particle and per timestep; a given (particle, draw) pair should only be used once per timestep
+    void uniforms (std::size_t particle, unsigned int firstDraw, float* out, unsigned int count) const {
+        Philox::uniforms(seed, particleId(particle), step, firstDraw, out, count);
+    }
+    void normals (std::size_t particle, unsigned int firstDraw, float* out, unsigned int count) const {
+        Philox::normals(seed, particleId(particle), step, firstDraw, out, count);
+    }
+    
+    // single uniform draw in [0, 1)
+    float uniform (std::size_t particle, unsigned int draw) const {
+        float u;
+        uniforms(particle, draw, &u, 1);
+        return u;
+    }
+    
+    // single standard normal draw
+    float normal (std::size_t particle, unsigned int draw) const {
+        float z;
+        normals(particle, draw, &z, 1);
+        return z;
     }
     
-    float rand01 () {
-        return rand(std::uniform_real_distribution(0.0f, 1.0f));
+    // online observables requested for the next update (see observeNextUpdate), and those of the last update that computed them
+    bool observeNext = false;
+    ObservableSample observed;
+    
+    // normal draws 0 .. perParticle-1 of all particles 0 .. count-1, in a single vectorized pass; see Philox::fillNormals
+    void fillNormals (std::size_t count, unsigned int perParticle, float* out) const {
+        Philox::fillNormals(seed, step, count, perParticle, out, particleIds.empty() ? nullptr : particleIds.data());
     }
     
 public:
     ModelBase (unsigned int seed) : seed(seed) { }
     
+    unsigned int getSeed () const { return seed; }
+    
     virtual ~ModelBase () { }
     virtual void update () = 0;
+    virtual std::size_t getParticleCount () const = 0;
     virtual float getMSD () = 0;
     virtual void print () = 0;
     virtual void toBinary (std::vector<std::uint8_t>& data) = 0;
     
+    // particles of a version 1 frame (see Model::toBinary), i.e. the position then direction vector of each, written at out, which must hold
+    // getParticleCount() * 2 * dimension floats; lets frames holding several models (see Ensemble) be laid out without intermediate copies
+    virtual void toBinaryParticles (std::uint8_t* out) = 0;
+    
+    // version 2 trajectory output (see Trajectory): fills in the fields of header describing the model, and appends a frame laid out as described by header
+    virtual void describe (TrajectoryHeader& header) = 0;
+    virtual void toFrame (std::vector<std::uint8_t>& data, const TrajectoryHeader& header) = 0;
+    
+    // checkpoints (see Checkpoint): appends everything needed to continue the simulation bit-exactly, besides the model parameters, then restores it
+    // random draws only depend on the seed and the timestep, so there is no generator state to save
+    virtual void saveState (std::vector<std::uint8_t>& data) = 0;
+    virtual void loadState (const std::vector<std::uint8_t>& data, std::size_t& at) = 0;
+    
+    // online observables (see ObservableSample), accumulated within the update pass itself rather than by separate passes over the particles
+    // enableObservables starts tracking the data they need (e.g. unwrapped displacements), and returns false if the model does not support them
+    virtual bool enableObservables () { return false; }
+    // the next update also computes the observables of the state it leads to, which getObservables then returns
+    virtual void observeNextUpdate () { observeNext = true; }
+    const ObservableSample& getObservables () const { return observed; }
+    
 };
 
 
-template<int D>
-struct Particle {
-    Vec<D> pos;
-    Vec<D-1> rotation; // in 2D, theta; in 3D theta (lat) and phi (long)
-    bool frozen = false; // frozen particles are not updated
-};
-
 // Templated base class from which the common models can derive, containing the particle data
 template<int D>
 class Model : public ModelBase {
@@ -54,82 +106,182 @@ public:
         std::size_t particleCount = 1024;
         float periodicity = 500;
         float boundary = 0;
+        Wall wall = Wall::Escape; // kind of wall at the boundary, when boundary > 0
+        Orientation orientation = Orientation::Angles; // how particle orientations are stored, and thus updated by the models
         bool startUniformly = true;
         unsigned int seed = 0;
+        float neighbourSkin = 0; // > 0 to reuse neighbour lists across timesteps, rebuilt once a particle moves further than half the skin
+        bool distributed = false; // particles are split across processes, and this one initially holds particles firstParticle .. firstParticle + particleCount - 1
+        std::uint64_t firstParticle = 0;
+        unsigned int compactBits = 0; // 16 or 32 for the neighbour loops to read compact, fixed-point copies of the particle data (see DoubleBufferedModel)
+        unsigned int reorderEvery = 0; // > 0 to sort particles in memory along a space-filling curve every that many timesteps (see DoubleBufferedModel::reorder)
     };
     
 protected:
     std::size_t particleCount;
-    std::vector<Particle<D>> particles;
+    ParticleStore<D> particles;
     float periodicity; // negative to disable periodic domain
     float boundary;
+    Wall wall; // Wall::None when there is no boundary
+    Orientation orientation; // see Params::orientation
+    bool distributed; // see Params::distributed
+    
+    // tracked once observables are enabled: periodic image of each particle along each axis, and its position at that time, from which
+    // displacements are measured across periodic boundaries
+    bool tracking = false;
+    AlignedVector<std::int32_t> images[D];
+    AlignedVector<float> origins[D];
+    std::vector<ObservableSums> threadSums;
+    
+    // pointers to the image arrays, as passed to BoundaryPolicy::apply; null when not tracking
+    struct ImageArrays {
+        std::int32_t* arrays[D];
+        std::int32_t* const* get () const { return arrays[0] != nullptr ? arrays : nullptr; }
+    };
+    ImageArrays imageArrays () {
+        ImageArrays result;
+        for (int d = 0; d < D; ++d) result.arrays[d] = tracking ? images[d].data() : nullptr;
+        return result;
+    }
+    
+    // adds particle i of store, as of the end of the timestep, to the observables accumulated by the calling thread
+    inline void observe (ObservableSums& sums, const ParticleStore<D>& store, std::size_t i) const {
+        Vec<D> displacement;
+        for (int d = 0; d < D; ++d) {
+            displacement.set(d, store.positions[d][i] + 2 * periodicity * images[d][i] - origins[d][i]);
+        }
+        sums.add<D>(displacement, store.direction(i), store.frozen(i));
+    }
+    
+    // clears the partial sums of each thread before an observed update, then adds them up into observed
+    void beginObservables () {
+        threadSums.assign(omp_get_max_threads(), ObservableSums());
+    }
+    void finishObservables () {
+        ObservableSums total;
+        for (const ObservableSums& sums : threadSums) total.add(sums);
+        observed = ObservableSample::from<D>(step, total);
+    }
     
-    Vec<D> randomLocation (float size);
-    Vec<D-1> randomRotation ();
+    // index at which outputs report particle i: its original index once particles have been reordered, so that outputs list them in the same order
+    // whether or not they are; when distributed, particles are reported as held, along with their global indices (see getParticleIds)
+    inline std::size_t outputIndex (std::size_t i) const { return distributed ? i : std::size_t(particleId(i)); }
+    
+    // random position within [-size, size)^D and random rotation for particle i, using uniform draws firstDraw .. firstDraw + D-1 (resp. D-2)
+    Vec<D> randomLocation (std::size_t i, float size, unsigned int firstDraw = 0);
+    Vec<D-1> randomRotation (std::size_t i, unsigned int firstDraw = 0);
+    
+    // per-timestep buffer of standard normal noise, holding draws 0 .. noisePerParticle-1 of each particle (i.e. the same values as normals(i, 0, ...))
+    // models which need noise call useNoise in their constructor; the buffer is then refilled at the start of each update
+    AlignedVector<float> noise;
+    unsigned int noisePerParticle = 0;
+    
+    void useNoise (unsigned int perParticle) {
+        noisePerParticle = perParticle;
+        noise.resize(particleCount * perParticle);
+    }
+    inline const float* noiseOf (std::size_t i) const { return &noise[i * noisePerParticle]; }
+    void prepareNoise () {
+        if (noisePerParticle > 0) {
+            noise.resize(particleCount * noisePerParticle); // the number of particles held varies when they are distributed across processes
+            fillNormals(particleCount, noisePerParticle, noise.data());
+        }
+    }
     
     virtual std::string getName () = 0;
-    virtual void updateParticle (std::size_t i) = 0;
-    void postProcess(Particle<D>* particle);
+    
+    // one timestep, calling updateParticle(i) on each particle that is not frozen, then applying the boundary conditions to it (see BoundaryPolicy),
+    // and accumulating its observables when requested
+    // concrete models implement update by passing a lambda calling their own (non-virtual) updateParticle, which is thus resolved at compile time and
+    // inlined into the loop, rather than called through the vtable for every particle
+    template<typename F>
+    void advance (F&& updateParticle);
+    
+    // particle data as of the end of the last timestep, i.e. what outputs should report
+    virtual const ParticleStore<D>& currentParticles () const { return particles; }
+
+    // fills in the indices of the (up to) 10 particles reported first by outputs, i.e. with outputIndex 0 .. 9, and returns how many there are
+    std::size_t firstOutputs (std::size_t (&shown)[10]) const;
+    
+    // displacement from b to a, taking the nearest periodic image of b when the domain is periodic
+    inline Vec<D> displacement (const Vec<D>& a, const Vec<D>& b) const {
+        Vec<D> delta = a - b;
+        if (periodicity > 0) {
+            delta.minimumImage(periodicity);
+        }
+        return delta;
+    }
     
 public:
     
-    Model (Params params) : ModelBase(params.seed), particleCount(params.particleCount), periodicity(params.periodicity), boundary(params.boundary) {
-        particles.reserve(particleCount);
+    Model (Params params) : ModelBase(params.seed), particleCount(params.particleCount), periodicity(params.periodicity), boundary(params.boundary),
+            wall(params.boundary > 0 ? params.wall : Wall::None), orientation(params.orientation), distributed(params.distributed) {
+        if (params.distributed) {
+            particleIds.resize(particleCount);
+            for (std::size_t i = 0; i < particleCount; ++i) particleIds[i] = params.firstParticle + i;
+        }
+        particles.setOrientationStorage(orientation);
+        particles.resize(particleCount);
         for (std::size_t i = 0; i < particleCount; ++i) {
-            particles.push_back({
-                params.startUniformly ? randomLocation(boundary > 0 ? boundary : periodicity > 0 ? periodicity : 500) : Vec<D>::Zero(),
-                randomRotation()
-            });
+            particles[i].setPos(params.startUniformly ? randomLocation(i, boundary > 0 ? boundary : periodicity > 0 ? periodicity : 500) : Vec<D>::Zero());
+            particles[i].setRotation(randomRotation(i, D));
         }
     }
     
     virtual ~Model () { }
     
+    std::size_t getParticleCount () const override { return particleCount; }
+    
+    // particles held, and their global indices if distributed (see particleIds)
+    const ParticleStore<D>& getParticles () const { return currentParticles(); }
+    const std::vector<std::uint64_t>& getParticleIds () const { return particleIds; }
     virtual float getMSD () override;
     virtual void print () override;
-    virtual void update () override;
     void toBinary (std::vector<std::uint8_t>& data) override;
+    void toBinaryParticles (std::uint8_t* out) override;
+    void describe (TrajectoryHeader& header) override;
+    void toFrame (std::vector<std::uint8_t>& data, const TrajectoryHeader& header) override;
+    void saveState (std::vector<std::uint8_t>& data) override;
+    void loadState (const std::vector<std::uint8_t>& data, std::size_t& at) override;
+    bool enableObservables () override;
     
 };
 
 
-template<>
-Vec<2> Model<2>::randomLocation (float size) {
-    return {
-        (rand01() * 2 - 1.0f) * size,
-        (rand01() * 2 - 1.0f) * size
-    };
-}
-
-template<>
-Vec<1> Model<2>::randomRotation () {
-    return { rand01() * PI * 2.0f };
+template<int D>
+Vec<D> Model<D>::randomLocation (std::size_t i, float size, unsigned int firstDraw) {
+    float u[D];
+    uniforms(i, firstDraw, u, D);
+    Vec<D> location;
+    for (int d = 0; d < D; ++d) {
+        location.set(d, (u[d] * 2 - 1.0f) * size);
+    }
+    return location;
 }
 
 template<>
-Vec<3> Model<3>::randomLocation (float size) {
-    return {
-        (rand01() * 2 - 1.0f) * size,
-        (rand01() * 2 - 1.0f) * size,
-        (rand01() * 2 - 1.0f) * size
-    };
+inline Vec<1> Model<2>::randomRotation (std::size_t i, unsigned int firstDraw) {
+    return { uniform(i, firstDraw) * PI * 2.0f };
 }
 
 template<>
-Vec<2> Model<3>::randomRotation () {
+inline Vec<2> Model<3>::randomRotation (std::size_t i, unsigned int firstDraw) {
+    float u[2];
+    uniforms(i, firstDraw, u, 2);
     return {
-        rand01() * PI * 2.0f,
-        rand01() * PI
+        u[0] * PI * 2.0f,
+        u[1] * PI
     };
 }
 
 template<int D>
 float Model<D>::getMSD () {
+    PROFILE_SCOPE("getMSD");
     float sum = 0.0f;
     
     #pragma omp parallel for reduction(+: sum)
     for (std::size_t i = 0; i < particleCount; ++i) {
-        sum += particles[i].pos.lengthSqr();
+        sum += particles.pos(i).lengthSqr();
     }
     
     return sum / particleCount;
@@ -138,8 +290,10 @@ float Model<D>::getMSD () {
 template<int D>
 void Model<D>::print () {
     std::printf("%s, %ld particles:\n", getName().c_str(), particleCount);
-    for (std::size_t i = 0, sz = particleCount > 10 ? 10 : particleCount; i < sz; ++i) {
-        std::printf("\t- (%ld) %s\n", i, particles[i].pos.toString().c_str());
+    std::size_t shown[10];
+    std::size_t sz = firstOutputs(shown);
+    for (std::size_t k = 0; k < sz; ++k) {
+        std::printf("\t- (%ld) %s\n", k, particles.pos(shown[k]).toString().c_str());
     }
     if (particleCount > 10) std::printf("\t- ... (only first 10 shown)\n");
     std::printf("MSD: %f\n", getMSD());
@@ -147,58 +301,224 @@ void Model<D>::print () {
 }
 
 template<int D>
-void Model<D>::postProcess (Particle<D>* particle) {
-    // ensure periodic domain
-    if (periodicity > 0) {
-        particle->pos.periodic(periodicity);
-    }
-    
-    // apply boundary condition
-    if (boundary > 0) {
-        if (particle->pos.clampLength(boundary)) {
-            // when hitting the boundary, bounce off
-            particle->rotation = VecUtils::toSpherical<D>(particle->pos.normalized() * -1);
-            
-            // particles that hit the boundary in the right spot (down the X axis) are considered to have "escaped"
-            if (particle->pos.X() >= boundary * 0.999) {
-                particle->frozen = true;
-            }
+std::size_t Model<D>::firstOutputs (std::size_t (&shown)[10]) const {
+    std::size_t sz = particleCount > 10 ? 10 : particleCount;
+    for (std::size_t k = 0; k < sz; ++k) shown[k] = k;
+    if (!distributed && !particleIds.empty()) {
+        for (std::size_t i = 0; i < particleCount; ++i) {
+            if (particleIds[i] < sz) shown[particleIds[i]] = i;
         }
     }
+    return sz;
 }
 
 template<int D>
-void Model<D>::update () {
-    #pragma omp parallel for
-    for (std::size_t i = 0; i < particleCount; ++i) {
-        if (particles[i].frozen) continue;
-        
-        // update single particle
-        updateParticle(i);
-        
-        postProcess(&particles[i]);
+template<typename F>
+void Model<D>::advance (F&& updateParticle) {
+    ++step;
+    {
+        PROFILE_SCOPE("noise");
+        prepareNoise();
     }
+    
+    bool observing = observeNext && tracking;
+    observeNext = false;
+    if (observing) beginObservables();
+    ImageArrays imageCounters = imageArrays();
+    
+    // timed per thread, without waiting on the others at the end of the loop, so that the profile shows how evenly the work was split
+    Boundary::dispatch<D>(periodicity, wall, [&](auto policy) {
+        #pragma omp parallel
+        {
+            PROFILE_SCOPE("update particles");
+            ObservableSums sums;
+            #pragma omp for nowait
+            for (std::size_t i = 0; i < particleCount; ++i) {
+                if (!particles.frozen(i)) {
+                    // update single particle
+                    updateParticle(i);
+                    
+                    policy.apply(particles[i], periodicity, boundary, imageCounters.get());
+                }
+                if (observing) observe(sums, particles, i);
+            }
+            if (observing) threadSums[omp_get_thread_num()] = sums;
+        }
+    });
+    if (observing) finishObservables();
 }
 
 template<int D>
 void Model<D>::toBinary (std::vector<std::uint8_t>& data) {
     
+    // the frame is laid out as: "AMM" | i32 particle count | i32 dimension | position then direction vector of each particle | 0 footer
+    // its size is known up front, so the buffer is sized once, then each particle is written at its own offset, in parallel
+    const std::size_t headerSize = 3 + 2 * sizeof(std::int32_t), particleSize = 2 * D * sizeof(float);
+    std::size_t start = data.size();
+    data.resize(start + headerSize + particleCount * particleSize + 1);
+    std::uint8_t* frame = &data[start];
+    
     // Header
-    data.push_back('A');
-    data.push_back('M');
-    data.push_back('M');
+    std::memcpy(frame, "AMM", 3);
     
     // Write the number of particles and the dimension
-    BinIO::writeSimple<std::int32_t>(data, particleCount);
-    BinIO::writeSimple<std::int32_t>(data, D);
+    std::int32_t header[2] = { std::int32_t(particleCount), D };
+    std::memcpy(frame + 3, header, sizeof(header));
     
+    toBinaryParticles(frame + headerSize);
+    
+    // Footer (not strictly required, but can help ensure the data read was valid)
+    frame[headerSize + particleCount * particleSize] = 0;
+    
+}
+
+template<int D>
+void Model<D>::toBinaryParticles (std::uint8_t* out) {
+    const std::size_t particleSize = 2 * D * sizeof(float);
+    const ParticleStore<D>& current = currentParticles();
+    #pragma omp parallel for
     for (std::size_t i = 0; i < particleCount; ++i) {
         // for each particle, write the position and direction vectors
-        BinIO::writeVec(data, particles[i].pos);
-        BinIO::writeVec(data, VecUtils::toCartesian<D>(particles[i].rotation));
+        float values[2 * D];
+        Vec<D> dir = current.direction(i);
+        for (int d = 0; d < D; ++d) {
+            values[d] = current.positions[d][i];
+            values[D + d] = dir[d];
+        }
+        std::memcpy(out + outputIndex(i) * particleSize, values, particleSize);
     }
+}
+
+template<int D>
+void Model<D>::describe (TrajectoryHeader& header) {
+    header.dimension = D;
+    header.particleCount = particleCount;
+    header.seed = getSeed();
+    header.periodicity = periodicity;
+    header.boundary = boundary;
+    header.model = getName();
+}
+
+template<int D>
+void Model<D>::toFrame (std::vector<std::uint8_t>& data, const TrajectoryHeader& header) {
+    const ParticleStore<D>& current = currentParticles();
+    std::size_t start = data.size();
+    data.resize(start + header.frameSize(), 0);
+    std::uint8_t* frame = &data[start];
+    std::memcpy(frame, &step, sizeof(step));
     
-    // Footer (not strictly required, but can help ensure the data read was valid)
-    data.push_back(0);
+    // arrays are copied as is while particles are stored in output order, and scattered to the output index of each particle otherwise
+    bool inOrder = distributed || particleIds.empty();
+    auto copy = [&](std::uint8_t* out, const AlignedVector<float>& values) {
+        if (inOrder) {
+            std::memcpy(out, values.data(), particleCount * sizeof(float));
+        } else {
+            float* to = reinterpret_cast<float*>(out);
+            #pragma omp parallel for
+            for (std::size_t i = 0; i < particleCount; ++i) to[outputIndex(i)] = values[i];
+        }
+    };
+    
+    // positions, one array per component
+    for (int d = 0; d < D; ++d) {
+        std::uint8_t* out = frame + header.positionsOffset(d);
+        if (header.positions == PositionEncoding::Fixed16) {
+            std::uint16_t* q = reinterpret_cast<std::uint16_t*>(out);
+            #pragma omp parallel for
+            for (std::size_t i = 0; i < particleCount; ++i) {
+                q[outputIndex(i)] = Trajectory::quantise(current.positions[d][i], periodicity);
+            }
+        } else {
+            copy(out, current.positions[d]);
+        }
+    }
     
+    // orientations, copied if stored as encoded, and converted otherwise
+    bool asStored = (header.orientations == OrientationEncoding::Angles) == (orientation == Orientation::Angles);
+    if (header.orientations == OrientationEncoding::Angles && asStored) {
+        for (int d = 0; d < D-1; ++d) {
+            copy(frame + header.orientationsOffset(d), current.rotations[d]);
+        }
+    } else if (header.orientations == OrientationEncoding::Directions && asStored) {
+        for (int d = 0; d < D; ++d) {
+            copy(frame + header.orientationsOffset(d), current.directions[d]);
+        }
+    } else if (header.orientations == OrientationEncoding::Angles) {
+        float* out[D-1];
+        for (int d = 0; d < D-1; ++d) out[d] = reinterpret_cast<float*>(frame + header.orientationsOffset(d));
+        #pragma omp parallel for
+        for (std::size_t i = 0; i < particleCount; ++i) {
+            Vec<D-1> rotation = current.rotation(i);
+            for (int d = 0; d < D-1; ++d) out[d][outputIndex(i)] = rotation[d];
+        }
+    } else if (header.orientations == OrientationEncoding::Directions) {
+        float* out[D];
+        for (int d = 0; d < D; ++d) out[d] = reinterpret_cast<float*>(frame + header.orientationsOffset(d));
+        #pragma omp parallel for
+        for (std::size_t i = 0; i < particleCount; ++i) {
+            Vec<D> dir = current.direction(i);
+            for (int d = 0; d < D; ++d) out[d][outputIndex(i)] = dir[d];
+        }
+    }
+}
+
+template<int D>
+void Model<D>::saveState (std::vector<std::uint8_t>& data) {
+    BinIO::writeSimple<std::uint32_t>(data, D);
+    BinIO::writeSimple<std::uint64_t>(data, particleCount);
+    BinIO::writeSimple<std::uint64_t>(data, step);
+    BinIO::writeSimple<std::uint8_t>(data, std::uint8_t(orientation));
+    currentParticles().save(data);
+    BinIO::writeSimple<std::uint64_t>(data, particleIds.size());
+    BinIO::writeArray(data, particleIds.data(), particleIds.size());
+    BinIO::writeSimple<std::uint8_t>(data, tracking ? 1 : 0);
+    if (tracking) {
+        for (int d = 0; d < D; ++d) {
+            BinIO::writeArray(data, images[d].data(), particleCount);
+            BinIO::writeArray(data, origins[d].data(), particleCount);
+        }
+    }
+}
+
+template<int D>
+void Model<D>::loadState (const std::vector<std::uint8_t>& data, std::size_t& at) {
+    std::uint32_t dimension = BinIO::readSimple<std::uint32_t>(data, at);
+    std::uint64_t count = BinIO::readSimple<std::uint64_t>(data, at);
+    if (dimension != D || count != particleCount) {
+        std::printf("Checkpoint holds %ld particles in %uD, but the model has %ld particles in %dD!\n", std::size_t(count), dimension, particleCount, D);
+        std::exit(1);
+    }
+    step = BinIO::readSimple<std::uint64_t>(data, at);
+    if (BinIO::readSimple<std::uint8_t>(data, at) != std::uint8_t(orientation)) {
+        std::printf("Checkpoint stores orientations as %s, but the model stores them as %s!\n",
+            orientation == Orientation::Angles ? "vectors" : "angles", orientation == Orientation::Angles ? "angles" : "vectors");
+        std::exit(1);
+    }
+    particles.load(data, at);
+    particleIds.resize(BinIO::readSimple<std::uint64_t>(data, at));
+    BinIO::readArray(data, at, particleIds.data(), particleIds.size());
+    bool tracked = BinIO::readSimple<std::uint8_t>(data, at) != 0;
+    if (tracking && !tracked) {
+        std::printf("Checkpoint was written without observables, which cannot be enabled when resuming from it!\n");
+        std::exit(1);
+    }
+    if (tracked) {
+        enableObservables();
+        for (int d = 0; d < D; ++d) {
+            BinIO::readArray(data, at, images[d].data(), particleCount);
+            BinIO::readArray(data, at, origins[d].data(), particleCount);
+        }
+    }
+}
+
+template<int D>
+bool Model<D>::enableObservables () {
+    // particles held by each process change over time when distributed, along with their indices
+    if (distributed) return false;
+    tracking = true;
+    for (int d = 0; d < D; ++d) {
+        images[d].assign(particleCount, 0);
+        origins[d].assign(particles.positions[d].begin(), particles.positions[d].begin() + particleCount);
+    }
+    return true;
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <functional>
 #include "Arguments.h"
 #include "models/Model.h"
 #include "models/RandomWalk.h"
@@ -8,6 +10,7 @@
 #include "models/ActiveBrownianMotion.h"
 #include "models/Vicsek.h"
 #include "models/Boids.h"
+#include "models/Ensemble.h"
 
 class ModelFactory {
     ModelFactory()=delete;
@@ -15,34 +18,74 @@ class ModelFactory {
     ModelFactory(ModelFactory&&)=delete;
 public:
     
+    /// Names of all models that can be built, as passed to -model
+    static const std::vector<std::string>& names () {
+        static const std::vector<std::string> all = { "random-walk", "run-and-tumble", "active-brownian", "vicsek", "boids" };
+        return all;
+    }
+    
+    /// Builds the model described by args; with processes > 0, the particles are split across that many processes (see DomainDecomposition),
+    /// and only the share initially held by the given process is built
     template<int D>
-    static ModelBase* build(Arguments& args) {
+    static ModelBase* build(Arguments& args, std::size_t process = 0, std::size_t processes = 0) {
         
         std::string name = args.read<std::string>("model");
         typename Model<D>::Params params;
         params.particleCount = args.read<int>("particles", 512);
         params.periodicity = args.read<int>("periodic-size", 500); // 0 for non-periodic domain
         params.boundary = args.read<int>("boundary-radius", 0); // 0 to remove boundary
+        std::string wall = args.read<std::string>("boundary-type", "escape"); // escape, reflect or absorb; see Wall
+        if (!Boundary::parse(wall, params.wall)) {
+            std::printf("Invalid boundary type %s!\n", wall.c_str());
+            std::exit(1);
+        }
+        // angles, or vectors to spare the models converting them every timestep; unrelated to -orientation, which selects what trajectory files store
+        std::string orientation = args.read<std::string>("orientation-storage", "angles");
+        if (orientation.compare("angles") == 0) {
+            params.orientation = Orientation::Angles;
+        } else if (orientation.compare("vectors") == 0) {
+            params.orientation = Orientation::Vectors;
+        } else {
+            std::printf("Invalid orientation storage %s, use angles or vectors!\n", orientation.c_str());
+            std::exit(1);
+        }
         params.startUniformly = !args.read<bool>("non-uniform-start", false);
         params.seed = args.read<int>("seed", 0);
-        
-        if (name.compare("random-walk") == 0) {
-            return new RandomWalk<D>(params);
+        params.neighbourSkin = args.read<float>("verlet-skin", 0); // 0 to query the cell list every timestep instead
+        params.reorderEvery = args.read<int>("reorder-every", 0); // 0 to keep particles in their initial order in memory
+        params.compactBits = args.read<int>("compact-neighbours", 0); // 16 or 32 bits; 0 for the neighbour loops to read float data
+        if (params.compactBits != 0 && params.compactBits != 16 && params.compactBits != 32) {
+            std::printf("Invalid compact neighbour data size %u, should be 16 or 32 bits!\n", params.compactBits);
+            std::exit(1);
         }
-        
-        if (name.compare("run-and-tumble") == 0) {
-            return new RunAndTumble<D>(args.read<float>("flip-prob", 0.1f), params);
-        }
-        
-        if (name.compare("active-brownian") == 0) {
-            return new ActiveBrownianMotion<D>(args.read<float>("angular-diffusion", 0.02f), params);
+        if (processes > 0) {
+            params.distributed = true;
+            params.firstParticle = params.particleCount * process / processes;
+            params.particleCount = params.particleCount * (process + 1) / processes - params.firstParticle;
         }
         
-        if (name.compare("vicsek") == 0) {
-            return new Vicsek<D>(args.read<float>("detection-radius", 25.0f), args.read<float>("angular-diffusion", 0.02f), params);
+        std::string kernels = args.read<std::string>("simd", "auto"); // auto, scalar, sse4, avx2 or avx512
+        if (!PairKernels::select(kernels)) {
+            std::printf("Invalid or unsupported SIMD instruction set %s!\n", kernels.c_str());
+            std::exit(1);
         }
         
-        if (name.compare("boids") == 0) {
+        // model-specific arguments are read once, then the model is created by make, once per replica in ensemble mode
+        typedef typename Model<D>::Params Params;
+        std::function<ModelBase*(const Params&)> make;
+        if (name.compare("random-walk") == 0) {
+            make = [](const Params& params) { return new RandomWalk<D>(params); };
+        } else if (name.compare("run-and-tumble") == 0) {
+            float flipProbability = args.read<float>("flip-prob", 0.1f);
+            make = [flipProbability](const Params& params) { return new RunAndTumble<D>(flipProbability, params); };
+        } else if (name.compare("active-brownian") == 0) {
+            float angularDiffusion = args.read<float>("angular-diffusion", 0.02f);
+            make = [angularDiffusion](const Params& params) { return new ActiveBrownianMotion<D>(angularDiffusion, params); };
+        } else if (name.compare("vicsek") == 0) {
+            float detectionRadius = args.read<float>("detection-radius", 25.0f);
+            float angularDiffusion = args.read<float>("angular-diffusion", 0.02f);
+            make = [detectionRadius, angularDiffusion](const Params& params) { return new Vicsek<D>(detectionRadius, angularDiffusion, params); };
+        } else if (name.compare("boids") == 0) {
             typename Boids<D>::Params boidsParams;
             boidsParams.detectionRadius = args.read<float>("detection-radius", 25.0f);
             boidsParams.separationRadius = args.read<float>("separation-radius", 5.0f);
@@ -51,10 +94,27 @@ public:
             boidsParams.alignmentCoeff = args.read<float>("alignment", 0.2f);
             boidsParams.cohesionCoeff = args.read<float>("cohesion", 0.2f);
             boidsParams.adoptionRate = args.read<float>("rate", 0.25f);
-            return new Boids<D>(boidsParams, params);
+            make = [boidsParams](const Params& params) { return new Boids<D>(boidsParams, params); };
+        } else {
+            std::printf("Invalid model name %s!\n", name.c_str());
+            std::exit(1);
         }
         
-        std::printf("Invalid model name %s!\n", name.c_str());
-        std::exit(1);
+        // ensemble mode: independent replicas of the model, with seeds derived from the given one, run concurrently (see Ensemble)
+        int replicas = processes > 0 ? 1 : args.read<int>("replicas", 1);
+        if (replicas < 1) {
+            std::printf("Invalid replica count %d, at least 1 is required!\n", replicas);
+            std::exit(1);
+        }
+        if (replicas > 1) {
+            std::vector<ModelBase*> members;
+            for (int r = 0; r < replicas; ++r) {
+                Params replicaParams = params;
+                replicaParams.seed = Ensemble::replicaSeed(params.seed, r);
+                members.push_back(make(replicaParams));
+            }
+            return new Ensemble(params.seed, members);
+        }
+        return make(params);
     }
 };
@@ -7,11 +7,13 @@ class RandomWalk : public Model<D> {
     
 protected:
     std::string getName () override { return "Random Walk"; }
-    void updateParticle (std::size_t i) override;
+    inline void updateParticle (std::size_t i);
     
 public:
     RandomWalk (typename Model<D>::Params params) : Model<D>(params) { }
     
+    void update () override { this->advance([this](std::size_t i) { updateParticle(i); }); }
+    
 };
 
 
@@ -20,11 +22,14 @@ public:
 template<int D>
 void RandomWalk<D>::updateParticle (std::size_t i) {
     
+    ParticleView<D> particle = this->particles[i];
+    
     // change direction at random
-    this->particles[i].rotation = this->randomRotation();
+    Vec<D-1> rotation = this->randomRotation(i);
+    Vec<D> direction = VecUtils::toCartesian<D>(rotation);
+    particle.setOrientation(rotation, direction);
     
     // move forward
-    Vec<D> direction = VecUtils::toCartesian<D>(this->particles[i].rotation);
-    this->particles[i].pos += direction;
+    particle.setPos(particle.pos() + direction);
     
 }
@@ -9,11 +9,13 @@ class RunAndTumble : public Model<D> {
     
 protected:
     std::string getName () override { return "Run & Tumble"; }
-    void updateParticle (std::size_t i) override;
+    inline void updateParticle (std::size_t i);
     
 public:
     RunAndTumble (float flipProbability, typename Model<D>::Params params);
     
+    void update () override { this->advance([this](std::size_t i) { updateParticle(i); }); }
+    
 };
 
 
@@ -25,15 +27,17 @@ RunAndTumble<D>::RunAndTumble (float flipProbability, typename Model<D>::Params
 template<int D>
 void RunAndTumble<D>::updateParticle (std::size_t i) {
     
+    ParticleView<D> particle = this->particles[i];
+    
     // tumble with probability flipProbability
-    float r = this->rand01();
+    float r = this->uniform(i, 0);
     if (r < flipProbability) {
         // Set direction to new value; the velocity v0 is considered to always be 1
-        this->particles[i].rotation = this->randomRotation();
+        particle.setRotation(this->randomRotation(i, 1));
     }
     
     // keep running
-    Vec<D> direction = VecUtils::toCartesian<D>(this->particles[i].rotation);
-    this->particles[i].pos += direction;
+    Vec<D> direction = particle.direction();
+    particle.setPos(particle.pos() + direction);
     
 }
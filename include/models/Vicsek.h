@@ -5,54 +5,64 @@
 template<int D>
 class Vicsek : public DoubleBufferedModel<D> {
     
+    float detectionRadius;
     float r2;
     float sqrt2Dr;
     
 protected:
     std::string getName () override { return "Vicsek model"; }
-    void updateParticle (std::size_t i) override;
+    float getInteractionRadius () override { return detectionRadius; }
+    inline void updateParticle (std::size_t i);
     
 public:
     Vicsek (float detectionRadius, float angularDiffusion, typename Model<D>::Params params);
     
+    void update () override { this->advance([this](std::size_t i) { updateParticle(i); }); }
+    
 };
 
 
 
 template<int D>
 Vicsek<D>::Vicsek (float detectionRadius, float angularDiffusion, typename Model<D>::Params params) :
-    DoubleBufferedModel<D>(params), r2(detectionRadius*detectionRadius), sqrt2Dr(std::sqrt(2.0f * angularDiffusion)) { }
+    DoubleBufferedModel<D>(params), detectionRadius(detectionRadius), r2(detectionRadius*detectionRadius), sqrt2Dr(std::sqrt(2.0f * angularDiffusion)) {
+    this->useNoise(D-1);
+}
 
 template<int D>
 void Vicsek<D>::updateParticle (std::size_t i) {
     
     // find mean rotation from neighbours
-    Vec<D> pos = (*this->particlesFront)[i].pos;
-    Vec<D> direction = VecUtils::toCartesian<D>((*this->particlesFront)[i].rotation);
-    unsigned int neighbourCount = 1;
-    for (std::size_t j = 0; j < this->particleCount; ++j) {
-        if (i == j) continue;
-        Vec<D> otherPos = (*this->particlesFront)[j].pos;
-        if ((pos-otherPos).lengthSqr() <= r2) { // distance squared <= radius squared
-            ++neighbourCount;
-            direction += VecUtils::toCartesian<D>((*this->particlesFront)[j].rotation);
-        }
-    }
-    Vec<D-1> rotation;
-    if (direction.normalize()) {
-        rotation = VecUtils::toSpherical<D>(direction);
-    } else { // if the average direction is exactly 0, just keep the previous direction for now
-        rotation = (*this->particlesFront)[i].rotation;
-    }
+    Vec<D> pos = this->particlesFront->pos(i);
+    Vec<D> direction = this->direction(i);
+    PairSums<D> neighbours = this->template sumNeighbours<false>(i, pos, r2);
+    direction += neighbours.direction;
+    const float* noise = this->noiseOf(i);
     
-    // apply white noise to rotation
-    for (int d = 0; d < D-1; ++d) {
-        rotation.set(d, rotation.get(d) + sqrt2Dr*this->rand(std::normal_distribution<float>(0.0f, 1.0f)));
+    if (this->orientation == Orientation::Vectors) {
+        // turn the mean direction by white noise, or the previous direction if the mean one is exactly 0
+        if (!direction.normalize()) {
+            direction = this->particlesFront->direction(i);
+        }
+        direction = VecUtils::turn<D>(direction, sqrt2Dr, noise);
+        this->particlesBack->setDirection(i, direction);
+    } else {
+        Vec<D-1> rotation;
+        if (direction.normalize()) {
+            rotation = VecUtils::toSpherical<D>(direction);
+        } else { // if the average direction is exactly 0, just keep the previous direction for now
+            rotation = this->particlesFront->rotation(i);
+        }
+        
+        // apply white noise to rotation
+        for (int d = 0; d < D-1; ++d) {
+            rotation.set(d, rotation.get(d) + sqrt2Dr*noise[d]);
+        }
+        this->particlesBack->setRotation(i, rotation);
+        direction = VecUtils::toCartesian<D>(rotation);
     }
     
     // update back buffer
-    (*this->particlesBack)[i].rotation = rotation;
-    direction = VecUtils::toCartesian<D>(rotation);
-    (*this->particlesBack)[i].pos = pos + direction;
+    this->particlesBack->setPos(i, pos + direction);
     
 }
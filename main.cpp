@@ -1,6 +1,13 @@
-
-#include <fstream>
+#include <memory>
 #include "Arguments.h"
+#include "FrameWriter.h"
+#include "Checkpoint.h"
+#include "Trajectory.h"
+#include "TrajectoryCodec.h"
+#include "TrajectoryConverter.h"
+#include "TrajectoryOptions.h"
+#include "Profiler.h"
+#include "Observables.h"
 #include "models/ModelFactory.h"
 
 int main (int argc, char** argv) {
@@ -10,8 +17,48 @@ int main (int argc, char** argv) {
     std::size_t iterations;
     std::string outputFile;
     unsigned int saveFrames;
+    unsigned int writeBuffers;
+    int format;
+    TrajectoryHeader header;
+    std::string checkpointFile;
+    std::size_t checkpointEvery;
+    std::vector<std::string> commandLine; // arguments of the run, including those of the run being resumed if any
+    std::vector<std::uint8_t> checkpoint;
+    CheckpointInfo resumed;
+    std::size_t stateAt = 0;
+    bool profile;
+    bool profileCounters;
+    std::string ensembleFile;
+    std::string traceFile;
+    std::string observablesFile;
+    std::size_t observeEvery;
     {
         Arguments args(argc, argv);
+        
+        // resume mode: carry on an interrupted run from its last checkpoint, with the same options unless given again (e.g. a larger -iter to extend it)
+        std::string resume = args.read<std::string>("resume", ""); // path to a checkpoint file
+        if (!resume.empty()) {
+            Checkpoint::read(resume, checkpoint, resumed, stateAt);
+            args.addDefaults(resumed.commandLine);
+            commandLine = resumed.commandLine;
+        }
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.compare("-resume") == 0 || arg.compare("--resume") == 0) ++i; // skip the checkpoint path too
+            else commandLine.push_back(arg);
+        }
+        
+        // conversion mode: turn a version 1 output file into a version 2 one, then exit
+        std::string convert = args.read<std::string>("convert", ""); // path to a version 1 file to convert
+        if (!convert.empty()) {
+            outputFile = args.read<std::string>("out", "results/out.bin");
+            header.saveEvery = args.read<int>("save-frames", 0);
+            header.periodicity = args.read<int>("periodic-size", 500); // only needed to quantise positions
+            TrajectoryOptions::read(args, header);
+            TrajectoryConverter::fromVersion1(convert, outputFile, header);
+            return 0;
+        }
+        
         unsigned int d = args.read<int>("dim", 2);
         switch (d) {
             case 2: model = ModelFactory::build<2>(args); break;
@@ -22,33 +69,178 @@ int main (int argc, char** argv) {
         }
         iterations = args.read<int>("iter", 1000);
         outputFile = args.read<std::string>("out", "results/out.bin");
-        saveFrames = args.read<int>("save-frames", 10); // 1 = save every single frame, 5 = save every 5 frames, etc.
+        saveFrames = args.read<int>("save-frames", 10); // 1 = save every single frame, 5 = save every 5 frames, etc.; 0 = only the final state
+        writeBuffers = args.read<int>("write-buffers", 3); // number of frames held in memory for the writer thread; the simulation waits when all are in use
+        format = args.read<int>("format", 2); // 2 for a global header, fixed-layout frames and a frame index; 1 for self-describing frames as in older versions
+        checkpointEvery = args.read<int>("checkpoint-every", 0); // iterations between checkpoints, from which the run can be resumed; 0 to disable
+        checkpointFile = args.read<std::string>("checkpoint", outputFile + ".checkpoint");
+        profile = args.read<bool>("profile", false); // time each phase of the run, and report where time goes once done
+        traceFile = args.read<std::string>("profile-trace", outputFile + ".trace.json"); // Chrome trace of the profiled phases, per thread
+        profileCounters = args.read<bool>("profile-counters", false); // also sample hardware counters (cycles, instructions, cache and branch misses) per phase; implies -profile
+        profile = profile || profileCounters;
+        ensembleFile = args.read<std::string>("ensemble-stats", outputFile + ".ensemble.csv"); // with -replicas, MSD across replicas at each saved frame
+        observablesFile = args.read<std::string>("observables", ""); // CSV time series of unwrapped MSD, polar and nematic order and frozen fraction
+        observeEvery = args.read<int>("observe-every", 1); // timesteps between rows of the observables time series
+        if (observeEvery < 1) observeEvery = 1;
+        TrajectoryOptions::read(args, header);
+        if (format != 1 && format != 2) {
+            std::printf("Invalid output format %d, use 1 or 2!\n", format);
+            exit(1);
+        }
+    }
+    
+    if (profile) {
+        if (!AMM_PROFILING) {
+            std::printf("Profiling was compiled out (PROFILING=0), -profile has no effect!\n");
+        }
+        Profiler::enable(profileCounters);
+        Profiler::nameThread("main");
     }
     
-    std::printf("Starting...\n\n");
+    // Describe the run in the output file header
+    if (format == 2) {
+        model->describe(header);
+        header.saveEvery = saveFrames;
+        for (std::size_t i = 0; i < commandLine.size(); ++i) {
+            if (i > 0) header.arguments += ' ';
+            header.arguments += commandLine[i];
+        }
+        if (header.positions == PositionEncoding::Fixed16 && header.periodicity <= 0) {
+            std::printf("16-bit positions are relative to the periodic box, and require a periodic domain!\n");
+            exit(1);
+        }
+    }
+    
+    // Online observables are tracked from the initial state, or restored along with the state of the run being resumed
+    if (!observablesFile.empty() && !model->enableObservables()) {
+        std::printf("Observables are not supported by this model!\n");
+        exit(1);
+    }
+    
+    // Restore the state of the run being resumed, if any
+    std::size_t firstIteration = 0;
+    if (!checkpoint.empty()) {
+        if (model->getSeed() != resumed.seed) {
+            std::printf("The seed of the model (%u) does not match that of the checkpoint (%u)!\n", model->getSeed(), resumed.seed);
+            exit(1);
+        }
+        model->loadState(checkpoint, stateAt);
+        firstIteration = resumed.iteration;
+        checkpoint = std::vector<std::uint8_t>();
+        std::printf("Resuming from iteration %ld...\n\n", firstIteration);
+    } else {
+        std::printf("Starting...\n\n");
+    }
     
     // Run the selected model for the given number of timesteps
     std::size_t progressCheck = iterations / 100;
     if (progressCheck == 0) progressCheck = 1;
-    std::vector<std::uint8_t> binaryData;
-    for (std::size_t i = 0; i < iterations; ++i) {
-        model->update();
-        if (i % saveFrames == 0) {
-            model->toBinary(binaryData);
+    std::unique_ptr<FrameWriter> output(resumed.trajectoryBytes > 0 ?
+        new FrameWriter(outputFile, writeBuffers, resumed.trajectoryBytes, resumed.frameOffsets) : new FrameWriter(outputFile, writeBuffers));
+    FrameWriter& writer = *output;
+    std::unique_ptr<TrajectoryCodec> codec;
+    std::vector<std::uint8_t> rawFrame;
+    if (format == 2 && header.compressed()) codec.reset(new TrajectoryCodec(header));
+    Ensemble* ensemble = dynamic_cast<Ensemble*>(model);
+    std::unique_ptr<ObservableWriter> observables;
+    if (!observablesFile.empty()) observables.reset(new ObservableWriter(observablesFile, firstIteration));
+    auto saveFrame = [&]() {
+        PROFILE_SCOPE("save frame");
+        if (ensemble) ensemble->recordObservables();
+        if (codec) {
+            rawFrame.clear();
+            model->toFrame(rawFrame, header);
+            PROFILE_SCOPE("compress");
+            codec->encode(rawFrame.data(), writer.acquire());
+        } else if (format == 2) {
+            model->toFrame(writer.acquire(), header);
+        } else {
+            model->toBinary(writer.acquire());
+        }
+        writer.submit();
+    };
+    std::unique_ptr<CheckpointWriter> checkpoints;
+    if (checkpointEvery > 0) checkpoints.reset(new CheckpointWriter(checkpointFile));
+    auto saveCheckpoint = [&](std::size_t nextIteration) {
+        PROFILE_SCOPE("save checkpoint");
+        CheckpointInfo info;
+        info.iteration = nextIteration;
+        info.seed = model->getSeed();
+        info.commandLine = commandLine;
+        info.trajectoryBytes = writer.getBytesSubmitted();
+        info.frameOffsets = writer.getFrameOffsets();
+        std::vector<std::uint8_t>& data = checkpoints->acquire();
+        Checkpoint::begin(data, info);
+        model->saveState(data);
+        Checkpoint::finish(data);
+        // the checkpoint only replaces the previous one once the frames and observables it accounts for are on disk too
+        std::size_t bytes = info.trajectoryBytes;
+        ObservableWriter* rows = observables.get();
+        if (rows) rows->flush();
+        checkpoints->submit([&writer, bytes, rows]() {
+            writer.syncTo(bytes);
+            if (rows) rows->sync();
+        });
+    };
+    if (format == 2 && firstIteration == 0) {
+        Trajectory::writeHeader(writer.acquire(), header);
+        writer.submit(false);
+    }
+    for (std::size_t i = firstIteration; i < iterations; ++i) {
+        Profiler::setStep(i + 1);
+        bool observe = observables && (i + 1) % observeEvery == 0;
+        if (observe) model->observeNextUpdate();
+        {
+            PROFILE_SCOPE("update");
+            model->update();
+        }
+        if (observe) observables->write(model->getObservables());
+        if (saveFrames > 0 && i % saveFrames == 0) {
+            saveFrame();
         }
         if (i % progressCheck == 0) {
             std::printf("%ld %%...\r", i * 100 / iterations);
             std::fflush(stdout);
         }
+        if (checkpoints && (i + 1) % checkpointEvery == 0 && i + 1 < iterations) {
+            saveCheckpoint(i + 1);
+        }
     }
     std::printf("100 %%.  \n\n");
     model->print();
     
-    // Export binary results
-    model->toBinary(binaryData);
-    std::ofstream file(outputFile, std::ios::binary);
-	file.write(reinterpret_cast<const char*>(&binaryData[0]), binaryData.size());
-	file.close();
+    // Export final state, and wait for all frames to reach the disk
+    saveFrame();
+    {
+        PROFILE_SCOPE("final write");
+        if (format == 2) {
+            writer.flush();
+            Trajectory::writeIndex(writer.acquire(), writer.getFrameOffsets());
+            writer.submit(false);
+        }
+        if (checkpoints) checkpoints->close();
+        writer.close();
+    }
+    std::printf("Wrote %ld frames (%.1f MB) to %s", writer.getFramesWritten(), writer.getBytesWritten() / 1048576.0, outputFile.c_str());
+    if (writer.getStallSeconds() > 0) std::printf(", simulation waited %.2f s on the disk", writer.getStallSeconds());
+    std::printf("\n");
+    if (observables) {
+        observables.reset();
+        std::printf("Wrote observables to %s\n", observablesFile.c_str());
+    }
+    if (ensemble) {
+        ensemble->writeObservables(ensembleFile);
+        std::printf("Wrote ensemble statistics to %s\n", ensembleFile.c_str());
+    }
+    if (checkpoints) {
+        std::printf("Wrote %ld checkpoints to %s", checkpoints->getCheckpointsWritten(), checkpointFile.c_str());
+        if (checkpoints->getStallSeconds() > 0) std::printf(", simulation waited %.2f s on them", checkpoints->getStallSeconds());
+        std::printf("\n");
+    }
+    if (profile && AMM_PROFILING) {
+        std::printf("\n");
+        Profiler::report(traceFile, model->getParticleCount() * (iterations - firstIteration));
+    }
     
     delete model;
     return 0;
@@ -0,0 +1,218 @@
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <omp.h>
+#include "Arguments.h"
+#include "models/ModelFactory.h"
+
+// Radius used to turn densities into box sizes, i.e. the default detection radius of the interacting models
+static const float DensityRadius = 25.0f;
+
+// One benchmarked configuration, along with its timings
+struct BenchResult {
+    std::string model;
+    int dimension;
+    std::size_t particles;
+    float density;           // mean number of other particles within DensityRadius of each particle
+    int periodicSize;
+    int threads;
+    std::size_t steps;       // timesteps per repetition
+    double rate;             // particle updates per second, averaged over repetitions
+    double rateStddev;       // standard deviation of the rate across repetitions
+    double efficiency = 1.0; // speedup over the run with the fewest threads, divided by the ratio of thread counts
+};
+
+// Comma-separated list of values, e.g. "1000,10000"
+template<typename T>
+static std::vector<T> readList (Arguments& args, const std::string& key, const std::string& defaultValue) {
+    std::string list = args.read<std::string>(key, defaultValue);
+    std::vector<T> values;
+    for (std::size_t start = 0; start <= list.size(); ) {
+        std::size_t end = std::min(list.find(',', start), list.size());
+        std::string item = list.substr(start, end - start);
+        char* parsed;
+        double value = std::strtod(item.c_str(), &parsed);
+        if (item.empty() || *parsed != '\0') {
+            std::printf("Could not read '%s' in the list of values of -%s!\n", item.c_str(), key.c_str());
+            std::exit(1);
+        }
+        values.push_back(T(value));
+        start = end + 1;
+    }
+    return values;
+}
+
+// Half size of the periodic box holding particles at the given density (see BenchResult)
+template<int D>
+static int periodicSizeFor (std::size_t particles, float density) {
+    double ball = D == 2 ? PI * DensityRadius * DensityRadius : 4.0 / 3.0 * PI * DensityRadius * DensityRadius * DensityRadius;
+    double volume = particles * ball / density;
+    return std::max(1, int(std::lround(0.5 * std::pow(volume, 1.0 / D))));
+}
+
+template<int D>
+static BenchResult run (const std::string& model, std::size_t particles, float density, int threads, const std::vector<std::string>& extraArgs,
+        std::size_t minSteps, double minSeconds, int repetitions) {
+
+    BenchResult result;
+    result.model = model;
+    result.dimension = D;
+    result.particles = particles;
+    result.density = density;
+    result.periodicSize = periodicSizeFor<D>(particles, density);
+    result.threads = threads;
+    omp_set_num_threads(threads);
+
+    std::vector<std::string> commandLine = { "-model", model, "-particles", std::to_string(particles), "-periodic-size", std::to_string(result.periodicSize), "-seed", "1" };
+    commandLine.insert(commandLine.end(), extraArgs.begin(), extraArgs.end());
+    ModelBase* instance;
+    {
+        Arguments args(commandLine);
+        instance = ModelFactory::build<D>(args);
+    }
+
+    // warm up (first touch of all buffers, neighbour structures reaching their steady-state size), and size repetitions to last at least minSeconds
+    auto start = std::chrono::steady_clock::now();
+    instance->update();
+    instance->update();
+    double perStep = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 2;
+    result.steps = std::max(minSteps, std::size_t(std::ceil(minSeconds / std::max(perStep, 1e-9))));
+
+    std::vector<double> rates;
+    for (int r = 0; r < repetitions; ++r) {
+        start = std::chrono::steady_clock::now();
+        for (std::size_t s = 0; s < result.steps; ++s) {
+            instance->update();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        rates.push_back(double(particles) * result.steps / seconds);
+    }
+    delete instance;
+
+    double sum = 0, sumSqr = 0;
+    for (double rate : rates) sum += rate;
+    result.rate = sum / rates.size();
+    for (double rate : rates) sumSqr += (rate - result.rate) * (rate - result.rate);
+    result.rateStddev = rates.size() > 1 ? std::sqrt(sumSqr / (rates.size() - 1)) : 0.0;
+    return result;
+}
+
+static void writeJson (const std::string& path, const std::vector<BenchResult>& results) {
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::printf("Could not open %s for writing!\n", path.c_str());
+        std::exit(1);
+    }
+    std::fprintf(file, "{\n  \"compiler\": \"%s\",\n  \"kernels\": \"%s\",\n  \"hardware_threads\": %d,\n  \"results\": [\n",
+        __VERSION__, PairKernels::name(PairKernels::selected()), omp_get_num_procs());
+    for (std::size_t k = 0; k < results.size(); ++k) {
+        const BenchResult& r = results[k];
+        std::fprintf(file, "    { \"model\": \"%s\", \"dimension\": %d, \"particles\": %ld, \"density\": %g, \"periodic_size\": %d, \"threads\": %d, \"steps\": %ld, "
+            "\"updates_per_second\": %.6g, \"updates_per_second_stddev\": %.6g, \"efficiency\": %.4f }%s\n",
+            r.model.c_str(), r.dimension, r.particles, r.density, r.periodicSize, r.threads, r.steps, r.rate, r.rateStddev, r.efficiency, k + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    std::fclose(file);
+}
+
+static void writeCsv (const std::string& path, const std::vector<BenchResult>& results) {
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::printf("Could not open %s for writing!\n", path.c_str());
+        std::exit(1);
+    }
+    std::fprintf(file, "model,dimension,particles,density,periodic_size,threads,steps,updates_per_second,updates_per_second_stddev,efficiency\n");
+    for (const BenchResult& r : results) {
+        std::fprintf(file, "%s,%d,%ld,%g,%d,%d,%ld,%.6g,%.6g,%.4f\n",
+            r.model.c_str(), r.dimension, r.particles, r.density, r.periodicSize, r.threads, r.steps, r.rate, r.rateStddev, r.efficiency);
+    }
+    std::fclose(file);
+}
+
+int main (int argc, char** argv) {
+
+    // Read console args
+    std::vector<std::string> models;
+    std::vector<int> dimensions;
+    std::vector<std::size_t> particleCounts;
+    std::vector<float> densities;
+    std::vector<int> threadCounts;
+    std::vector<std::string> extraArgs;
+    std::size_t minSteps;
+    double minSeconds;
+    int repetitions;
+    std::string jsonFile, csvFile;
+    {
+        Arguments args(argc, argv);
+        std::string modelList = args.read<std::string>("models", "all"); // comma-separated model names, or all
+        if (modelList.compare("all") == 0) {
+            models = ModelFactory::names();
+        } else {
+            for (std::size_t start = 0; start <= modelList.size(); ) {
+                std::size_t end = std::min(modelList.find(',', start), modelList.size());
+                models.push_back(modelList.substr(start, end - start));
+                start = end + 1;
+            }
+        }
+        dimensions = readList<int>(args, "dims", "2,3");
+        for (int d : dimensions) {
+            if (d != 2 && d != 3) {
+                std::printf("Invalid dimension %d, only 2D and 3D are supported.\n", d);
+                std::exit(1);
+            }
+        }
+        particleCounts = readList<std::size_t>(args, "particles", "1000,10000,100000,1000000");
+        densities = readList<float>(args, "densities", "1,10"); // mean number of neighbours within a radius of 25, which sets the box size
+        std::string defaultThreads;
+        for (int t = 1; t < omp_get_max_threads(); t *= 2) defaultThreads += std::to_string(t) + ",";
+        defaultThreads += std::to_string(omp_get_max_threads());
+        threadCounts = readList<int>(args, "threads", defaultThreads);
+        minSteps = args.read<int>("steps", 5); // minimum timesteps per repetition
+        minSeconds = args.read<float>("min-time", 0.5f); // minimum duration of each repetition, in seconds
+        repetitions = std::max(1, args.read<int>("repetitions", 5));
+        jsonFile = args.read<std::string>("json", "results/bench.json");
+        csvFile = args.read<std::string>("csv", "results/bench.csv");
+        float skin = args.read<float>("verlet-skin", 0);
+        if (skin > 0) extraArgs = { "-verlet-skin", std::to_string(skin) };
+        std::string kernels = args.read<std::string>("simd", "auto");
+        extraArgs.insert(extraArgs.end(), { "-simd", kernels });
+    }
+    for (const std::string& model : models) {
+        if (std::find(ModelFactory::names().begin(), ModelFactory::names().end(), model) == ModelFactory::names().end()) {
+            std::printf("Invalid model name %s!\n", model.c_str());
+            std::exit(1);
+        }
+    }
+    std::sort(threadCounts.begin(), threadCounts.end());
+
+    std::printf("%-16s %3s %9s %8s %7s %7s %6s %14s %8s %10s\n", "model", "dim", "particles", "density", "box", "threads", "steps", "updates/s", "stddev", "efficiency");
+    std::vector<BenchResult> results;
+    for (const std::string& model : models) {
+        for (int d : dimensions) {
+            for (std::size_t particles : particleCounts) {
+                for (float density : densities) {
+                    std::size_t first = results.size();
+                    for (int threads : threadCounts) {
+                        BenchResult result = d == 3 ?
+                            run<3>(model, particles, density, threads, extraArgs, minSteps, minSeconds, repetitions) :
+                            run<2>(model, particles, density, threads, extraArgs, minSteps, minSeconds, repetitions);
+                        const BenchResult& base = results.size() > first ? results[first] : result;
+                        result.efficiency = (result.rate / base.rate) / (double(result.threads) / base.threads);
+                        results.push_back(result);
+                        std::printf("%-16s %3d %9ld %8g %7d %7d %6ld %14.4g %7.1f%% %10.2f\n", model.c_str(), d, particles, density, result.periodicSize,
+                            threads, result.steps, result.rate, 100.0 * result.rateStddev / result.rate, result.efficiency);
+                        std::fflush(stdout);
+                    }
+                }
+            }
+        }
+    }
+
+    writeJson(jsonFile, results);
+    writeCsv(csvFile, results);
+    std::printf("\nWrote results to %s and %s\n", jsonFile.c_str(), csvFile.c_str());
+    return 0;
+}
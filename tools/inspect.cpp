@@ -0,0 +1,140 @@
+#include <vector>
+#include <cmath>
+#include "Arguments.h"
+#include "TrajectoryReader.h"
+#include "VecUtils.h"
+
+// Statistics computed over all particles of one frame
+struct FrameStats {
+    std::uint64_t step;
+    double msd;         // mean squared distance from the origin, as reported by the models
+    double msdFirst;    // mean squared displacement since the first frame (nearest periodic image when the box is periodic)
+    double polarOrder;  // norm of the mean direction, 0 for disordered and 1 for fully aligned particles; NaN when orientations are not stored
+    float min[3], max[3];
+};
+
+// Unit direction vector of particle i, from whichever orientation encoding the file uses
+template<int D>
+static Vec<D> directionOf (const TrajectoryFrame& frame, OrientationEncoding encoding, std::size_t i) {
+    if (encoding == OrientationEncoding::Directions) {
+        Vec<D> dir;
+        for (int d = 0; d < D; ++d) dir.set(d, frame.orientations[d][i]);
+        return dir;
+    }
+    Vec<D-1> rotation;
+    for (int d = 0; d < D-1; ++d) rotation.set(d, frame.orientations[d][i]);
+    return VecUtils::toCartesian<D>(rotation);
+}
+
+template<int D>
+static FrameStats computeStats (const TrajectoryHeader& header, const TrajectoryFrame& frame, const TrajectoryFrame& first, float periodicity) {
+
+    FrameStats stats;
+    stats.step = frame.step;
+    for (int d = 0; d < 3; ++d) {
+        stats.min[d] = INFINITY;
+        stats.max[d] = -INFINITY;
+    }
+    double msd = 0, msdFirst = 0;
+    Vec<D, double> directionSum = Vec<D, double>::Zero();
+    for (std::size_t i = 0; i < frame.particleCount; ++i) {
+        Vec<D> pos, delta;
+        for (int d = 0; d < D; ++d) {
+            pos.set(d, frame.positions[d][i]);
+            delta.set(d, pos[d] - first.positions[d][i]);
+            stats.min[d] = std::fmin(stats.min[d], pos[d]);
+            stats.max[d] = std::fmax(stats.max[d], pos[d]);
+        }
+        if (periodicity > 0) delta.minimumImage(periodicity);
+        msd += pos.lengthSqr();
+        msdFirst += delta.lengthSqr();
+        if (header.orientations != OrientationEncoding::None) {
+            Vec<D> dir = directionOf<D>(frame, header.orientations, i);
+            for (int d = 0; d < D; ++d) directionSum.set(d, directionSum[d] + dir[d]);
+        }
+    }
+    double n = frame.particleCount > 0 ? double(frame.particleCount) : 1.0;
+    stats.msd = msd / n;
+    stats.msdFirst = msdFirst / n;
+    stats.polarOrder = header.orientations != OrientationEncoding::None ? std::sqrt(directionSum.lengthSqr()) / n : NAN;
+    return stats;
+}
+
+int main (int argc, char** argv) {
+
+    // Read console args
+    std::string inputFile;
+    bool csv;
+    int every;
+    int periodicSize;
+    {
+        Arguments args(argc, argv);
+        inputFile = args.read<std::string>("in");
+        csv = args.read<bool>("csv", false); // print statistics as CSV instead of a table
+        every = args.read<int>("every", 1); // only report every n-th frame
+        if (every < 1) every = 1;
+        periodicSize = args.read<int>("periodic-size", -1); // periodic domain size for displacements; defaults to that of the file (version 2), or none (version 1)
+    }
+
+    TrajectoryReader reader(inputFile);
+    if (!reader.isOpen()) {
+        std::printf("Could not read trajectory: %s\n", reader.getError().c_str());
+        std::exit(1);
+    }
+
+    const TrajectoryHeader& header = reader.getHeader();
+    std::size_t frameCount = reader.getFrameCount();
+    if (!csv) {
+        static const char* orientationNames[] = { "none", "directions", "angles" };
+        std::printf("%s: version %d, %ld frames of %ld particles in %dD\n", inputFile.c_str(), reader.getVersion(), frameCount, std::size_t(header.particleCount), header.dimension);
+        if (reader.getVersion() == 2) {
+            std::printf("Model: %s, seed %u, saved every %u steps\n", header.model.c_str(), header.seed, header.saveEvery);
+            std::printf("Arguments: %s\n", header.arguments.c_str());
+            std::printf("Periodic size: %g, boundary: %g\n", header.periodicity, header.boundary);
+            std::printf("Fields: %s positions, %s orientations\n", header.positions == PositionEncoding::Fixed16 ? "16-bit fixed point" : "float", orientationNames[int(header.orientations)]);
+            if (header.compressed()) std::printf("Compressed, keyframe every %u frames\n", header.keyframeInterval);
+        }
+        std::printf("\n");
+    }
+    if (frameCount == 0) return 0;
+    float periodicity = periodicSize >= 0 ? float(periodicSize) : reader.getVersion() == 2 ? header.periodicity : 0;
+
+    // frames are independent, so statistics are computed in parallel across frames; each thread only touches the pages of the frames it reads
+    // (compressed frames are decoded by each thread in turn from the closest keyframe, so each thread is given a contiguous range of frames)
+    std::vector<std::size_t> selected;
+    for (std::size_t k = 0; k < frameCount; k += every) selected.push_back(k);
+    if (selected.back() != frameCount - 1) selected.push_back(frameCount - 1);
+    std::vector<FrameStats> stats(selected.size());
+    TrajectoryCursor firstCursor;
+    TrajectoryFrame first = reader.frame(0, firstCursor);
+    #pragma omp parallel
+    {
+        TrajectoryCursor cursor;
+        #pragma omp for schedule(static)
+        for (std::size_t s = 0; s < selected.size(); ++s) {
+            TrajectoryFrame frame = reader.frame(selected[s], cursor);
+            stats[s] = header.dimension == 2 ? computeStats<2>(header, frame, first, periodicity) : computeStats<3>(header, frame, first, periodicity);
+        }
+    }
+
+    if (csv) {
+        std::printf("frame,step,msd,msd_first,polar_order");
+        for (std::uint32_t d = 0; d < header.dimension; ++d) std::printf(",min_%c,max_%c", 'x' + d, 'x' + d);
+        std::printf("\n");
+    } else {
+        std::printf("%8s %10s %14s %14s %8s   %s\n", "frame", "step", "MSD", "MSD (first)", "polar", "extent");
+    }
+    for (std::size_t s = 0; s < selected.size(); ++s) {
+        const FrameStats& f = stats[s];
+        if (csv) {
+            std::printf("%ld,%lu,%g,%g,%g", selected[s], f.step, f.msd, f.msdFirst, f.polarOrder);
+            for (std::uint32_t d = 0; d < header.dimension; ++d) std::printf(",%g,%g", f.min[d], f.max[d]);
+        } else {
+            std::printf("%8ld %10lu %14.4f %14.4f %8.4f  ", selected[s], f.step, f.msd, f.msdFirst, f.polarOrder);
+            for (std::uint32_t d = 0; d < header.dimension; ++d) std::printf(" [%.1f, %.1f]", f.min[d], f.max[d]);
+        }
+        std::printf("\n");
+    }
+
+    return 0;
+}
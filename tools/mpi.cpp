@@ -0,0 +1,120 @@
+#include <vector>
+#include <string>
+#include <chrono>
+#include <mpi.h>
+#include "Arguments.h"
+#include "DomainDecomposition.h"
+#include "DistributedTrajectory.h"
+#include "TrajectoryOptions.h"
+#include "models/ModelFactory.h"
+
+// Runs a model whose particles are split across the processes of MPI_COMM_WORLD, writing a version 2 trajectory file in parallel
+template<int D>
+static void simulate (ModelBase* model, std::size_t iterations, unsigned int saveFrames, const std::string& outputFile, TrajectoryHeader header) {
+    int rank, processes;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &processes);
+
+    DoubleBufferedModel<D>* interacting = dynamic_cast<DoubleBufferedModel<D>*>(model);
+    model->describe(header);
+    if (interacting == nullptr || header.periodicity <= 0 || header.boundary > 0) {
+        if (rank == 0) std::printf("Only interacting models (vicsek, boids) in a periodic domain without boundary can be distributed across processes!\n");
+        MPI_Finalize();
+        std::exit(1);
+    }
+    std::uint64_t localCount = model->getParticleCount(), totalCount = 0;
+    MPI_Allreduce(&localCount, &totalCount, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    header.particleCount = totalCount;
+
+    DomainDecomposition<D> domain(MPI_COMM_WORLD, header.periodicity);
+    interacting->setExchange(&domain);
+    DistributedTrajectory<D> writer(outputFile, header, domain.communicator());
+    auto saveFrame = [&](std::uint64_t step) {
+        writer.writeFrame(step, interacting->getParticles(), interacting->getParticleIds());
+    };
+    if (rank == 0) {
+        std::printf("Starting on %d processes (", processes);
+        for (int d = 0; d < D; ++d) std::printf(d == 0 ? "%d" : " x %d", domain.getDims(d));
+        std::printf(" subdomains), %lu particles...\n\n", totalCount);
+    }
+
+    // Run the model for the given number of timesteps
+    std::size_t progressCheck = iterations / 100;
+    if (progressCheck == 0) progressCheck = 1;
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        model->update();
+        if (saveFrames > 0 && i % saveFrames == 0) {
+            saveFrame(i + 1);
+        }
+        if (rank == 0 && i % progressCheck == 0) {
+            std::printf("%ld %%...\r", i * 100 / iterations);
+            std::fflush(stdout);
+        }
+    }
+    saveFrame(iterations);
+    writer.close();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Summary, over all processes
+    double msd = model->getMSD() * model->getParticleCount(), totalMsd = 0;
+    MPI_Reduce(&msd, &totalMsd, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    localCount = model->getParticleCount();
+    std::uint64_t fewest = 0, most = 0;
+    MPI_Reduce(&localCount, &fewest, 1, MPI_UINT64_T, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&localCount, &most, 1, MPI_UINT64_T, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        std::printf("100 %%.  \n\n");
+        std::printf("%s, %lu particles over %d processes (%lu to %lu each)\n", header.model.c_str(), totalCount, processes, fewest, most);
+        std::printf("MSD: %f\n", totalMsd / totalCount);
+        std::printf("%ld timesteps in %.2f s, %.4g particle updates/s\n\n", iterations, seconds, double(totalCount) * iterations / seconds);
+        std::printf("Wrote %ld frames (%.1f MB) to %s\n", writer.getFramesWritten(), writer.getBytesWritten() / 1048576.0, outputFile.c_str());
+    }
+}
+
+int main (int argc, char** argv) {
+
+    // OpenMP threads within each process, MPI calls from the main thread only
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int rank, processes;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &processes);
+
+    // Read console args, as for amm (each process builds its initial share of the particles)
+    ModelBase* model;
+    unsigned int d;
+    std::size_t iterations;
+    std::string outputFile;
+    unsigned int saveFrames;
+    TrajectoryHeader header;
+    {
+        Arguments args(argc, argv);
+        d = args.read<int>("dim", 2);
+        switch (d) {
+            case 2: model = ModelFactory::build<2>(args, rank, processes); break;
+            case 3: model = ModelFactory::build<3>(args, rank, processes); break;
+            default:
+                if (rank == 0) std::printf("Invalid dimension %d, only 2D and 3D are supported.\n", d);
+                MPI_Finalize();
+                exit(1);
+        }
+        iterations = args.read<int>("iter", 1000);
+        outputFile = args.read<std::string>("out", "results/out.bin");
+        saveFrames = args.read<int>("save-frames", 10); // 1 = save every single frame, 5 = save every 5 frames, etc.; 0 = only the final state
+        header.saveEvery = saveFrames;
+        TrajectoryOptions::read(args, header); // compression is rejected by DistributedTrajectory
+        for (int i = 1; i < argc; ++i) {
+            if (i > 1) header.arguments += ' ';
+            header.arguments += argv[i];
+        }
+    }
+
+    if (d == 3) simulate<3>(model, iterations, saveFrames, outputFile, header);
+    else simulate<2>(model, iterations, saveFrames, outputFile, header);
+
+    delete model;
+    MPI_Finalize();
+    return 0;
+}
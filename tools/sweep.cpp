@@ -0,0 +1,358 @@
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <sys/stat.h>
+#include <omp.h>
+#include "Arguments.h"
+#include "WorkStealingPool.h"
+#include "models/ModelFactory.h"
+
+// One run of the sweep: its command line, the full set of parameters it was identified by, and its results
+struct SweepPoint {
+    std::vector<std::string> commandLine;
+    std::map<std::string, std::string> parameters; // every key read to build and run the model, with the value used (see Arguments::record)
+    std::string key;                               // canonical description of the run, hashed into its cache entry
+    std::uint64_t hash;
+    int dimension;
+    std::size_t iterations;
+    unsigned int saveFrames;
+    bool cached = false;
+    std::vector<std::pair<std::uint64_t, double>> msd; // MSD at each saved timestep, as amm would save frames
+    double seconds = 0;
+};
+
+// 64-bit FNV-1a, continuing from a previous hash
+static std::uint64_t fnv1a (const void* data, std::size_t size, std::uint64_t hash = 14695981039346656037ull) {
+    const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Hash of this executable, so that results cached by another build (whose models may behave differently) are never reused
+static std::uint64_t binaryVersion () {
+    std::FILE* file = std::fopen("/proc/self/exe", "rb");
+    if (file == nullptr) {
+        std::printf("Could not read /proc/self/exe to identify this build!\n");
+        std::exit(1);
+    }
+    std::uint64_t hash = fnv1a(nullptr, 0);
+    std::vector<std::uint8_t> buffer(1 << 20);
+    std::size_t read;
+    while ((read = std::fread(buffer.data(), 1, buffer.size(), file)) > 0) hash = fnv1a(buffer.data(), read, hash);
+    std::fclose(file);
+    return hash;
+}
+
+// Splits a command line into key/value pairs as Arguments does, later values overriding earlier ones
+static void assign (std::map<std::string, std::string>& into, const std::vector<std::string>& commandLine) {
+    std::string key;
+    for (const std::string& arg : commandLine) {
+        if (arg.empty()) continue;
+        if (arg[0] == '-') {
+            key = arg.substr(arg.compare(0, 2, "--") == 0 ? 2 : 1);
+            into[key] = "true";
+        } else if (!key.empty()) {
+            into[key] = arg;
+            key.clear();
+        } else {
+            std::printf("Error reading arguments: value '%s' is not bound to a key (did you mean '-%s'?)\n", arg.c_str(), arg.c_str());
+            std::exit(1);
+        }
+    }
+}
+
+static std::vector<std::string> split (const std::string& str, const char* separators) {
+    std::vector<std::string> parts;
+    for (std::size_t start = 0; start <= str.size(); ) {
+        std::size_t end = std::min(str.find_first_of(separators, start), str.size());
+        if (end > start) parts.push_back(str.substr(start, end - start));
+        start = end + 1;
+    }
+    return parts;
+}
+
+// Parameter sets of -points: one command line per line, blank lines and lines starting with # being skipped
+static std::vector<std::vector<std::string>> readPoints (const std::string& path) {
+    std::vector<std::vector<std::string>> points;
+    std::FILE* file = std::fopen(path.c_str(), "r");
+    if (file == nullptr) {
+        std::printf("Could not open %s for reading!\n", path.c_str());
+        std::exit(1);
+    }
+    char line[4096];
+    while (std::fgets(line, sizeof(line), file) != nullptr) {
+        std::vector<std::string> args = split(line, " \t\r\n");
+        if (!args.empty() && args[0][0] != '#') points.push_back(args);
+    }
+    std::fclose(file);
+    return points;
+}
+
+// Cartesian product of the values of -grid, e.g. "angular-diffusion=0.01,0.02;seed=1,2,3", each as a command line
+static std::vector<std::vector<std::string>> expandGrid (const std::string& grid) {
+    std::vector<std::vector<std::string>> points = { { } };
+    for (const std::string& axis : split(grid, ";")) {
+        std::size_t equals = axis.find('=');
+        if (equals == std::string::npos || equals == 0) {
+            std::printf("Could not read '%s' in -grid, expected key=value,value,...!\n", axis.c_str());
+            std::exit(1);
+        }
+        std::string key = axis.substr(0, equals);
+        std::vector<std::string> values = split(axis.substr(equals + 1), ",");
+        if (values.empty()) {
+            std::printf("No values given for %s in -grid!\n", key.c_str());
+            std::exit(1);
+        }
+        std::vector<std::vector<std::string>> expanded;
+        for (const std::vector<std::string>& point : points) {
+            for (const std::string& value : values) {
+                expanded.push_back(point);
+                expanded.back().insert(expanded.back().end(), { "-" + key, value });
+            }
+        }
+        points = expanded;
+    }
+    return points;
+}
+
+// Reads the parameters of a point as the run will, without running it: this both validates them (an invalid point would otherwise only fail once
+// scheduled, taking the whole sweep down) and fills in every default, so that runs identical but for how they were written share a cache entry
+static void resolve (SweepPoint& point, std::uint64_t version) {
+    {
+        Arguments args(point.commandLine);
+        args.record(point.parameters);
+        point.dimension = args.read<int>("dim", 2);
+        ModelBase* model = nullptr;
+        switch (point.dimension) {
+            case 2: model = ModelFactory::build<2>(args); break;
+            case 3: model = ModelFactory::build<3>(args); break;
+            default:
+                std::printf("Invalid dimension %d, only 2D and 3D are supported.\n", point.dimension);
+                std::exit(1);
+        }
+        delete model;
+        point.iterations = args.read<int>("iter", 1000);
+        point.saveFrames = std::max(1, args.read<int>("save-frames", 10));
+    }
+    // runs sample the MSD at least every step, so that -save-frames 0 behaves as, and shares its cache entry with, -save-frames 1
+    point.parameters["save-frames"] = std::to_string(point.saveFrames);
+    char versionString[32];
+    std::snprintf(versionString, sizeof(versionString), "%016lx", version);
+    point.key = std::string("binary ") + versionString + "\n";
+    for (const auto& pair : point.parameters) point.key += pair.first + " " + pair.second + "\n";
+    point.hash = fnv1a(point.key.data(), point.key.size());
+}
+
+static std::string entryPath (const std::string& cache, std::uint64_t hash) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016lx.csv", hash);
+    return cache + "/" + name;
+}
+
+// Cache entries hold the key of their run, each line prefixed by '#', then the results as CSV; an entry whose key differs (i.e. a hash collision) is a miss
+static bool loadEntry (const std::string& path, SweepPoint& point) {
+    std::FILE* file = std::fopen(path.c_str(), "r");
+    if (file == nullptr) return false;
+    std::string key;
+    std::vector<std::pair<std::uint64_t, double>> msd;
+    double seconds = -1;
+    char line[4096];
+    while (std::fgets(line, sizeof(line), file) != nullptr) {
+        unsigned long step;
+        double value;
+        if (line[0] == '#') {
+            if (std::sscanf(line, "# seconds %lf", &seconds) != 1) key += line + 2;
+        } else if (std::sscanf(line, "%lu,%lf", &step, &value) == 2) {
+            msd.push_back({ step, value });
+        }
+    }
+    std::fclose(file);
+    if (key != point.key || seconds < 0 || msd.empty()) return false;
+    point.msd = msd;
+    point.seconds = seconds;
+    return true;
+}
+
+// Written to a temporary file then renamed, so that an interrupted sweep never leaves a partial entry behind, and concurrent sweeps sharing the cache
+// at worst compute the same entry twice
+static bool storeEntry (const std::string& path, const SweepPoint& point) {
+    std::string temporary = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::FILE* file = std::fopen(temporary.c_str(), "w");
+    if (file == nullptr) return false;
+    for (const std::string& line : split(point.key, "\n")) std::fprintf(file, "# %s\n", line.c_str());
+    std::fprintf(file, "# seconds %.6f\n", point.seconds);
+    std::fprintf(file, "step,msd\n");
+    for (const auto& sample : point.msd) std::fprintf(file, "%lu,%.9g\n", sample.first, sample.second);
+    bool written = std::fflush(file) == 0;
+    written = std::fclose(file) == 0 && written;
+    if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Creates the directory at path along with its missing parents
+static void makeDirectories (const std::string& path) {
+    for (std::size_t end = path.find('/', 1); ; end = path.find('/', end + 1)) {
+        std::string prefix = path.substr(0, end);
+        if (::mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+            std::printf("Could not create directory %s: %s\n", prefix.c_str(), std::strerror(errno));
+            std::exit(1);
+        }
+        if (end == std::string::npos) break;
+    }
+}
+
+// Held while building a model, which (re)selects the SIMD kernels process-wide
+static std::mutex buildMutex;
+
+static void run (SweepPoint& point) {
+    ModelBase* model;
+    {
+        std::lock_guard<std::mutex> lock(buildMutex);
+        Arguments args(point.commandLine);
+        args.read<int>("dim", 2);
+        model = point.dimension == 3 ? ModelFactory::build<3>(args) : ModelFactory::build<2>(args);
+        args.read<int>("iter", 1000);
+        args.read<int>("save-frames", 10);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < point.iterations; ++i) {
+        model->update();
+        if (i % point.saveFrames == 0) {
+            point.msd.push_back({ i + 1, model->getMSD() });
+        }
+    }
+    if (point.msd.empty() || point.msd.back().first != point.iterations) {
+        point.msd.push_back({ point.iterations, model->getMSD() });
+    }
+    point.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    delete model;
+}
+
+static void writeCsv (const std::string& path, const std::vector<SweepPoint>& points, const std::set<std::string>& swept) {
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::printf("Could not open %s for writing!\n", path.c_str());
+        std::exit(1);
+    }
+    std::fprintf(file, "point,hash,cached");
+    for (const std::string& key : swept) std::fprintf(file, ",%s", key.c_str());
+    std::fprintf(file, ",steps,msd,seconds\n");
+    for (std::size_t p = 0; p < points.size(); ++p) {
+        const SweepPoint& point = points[p];
+        std::fprintf(file, "%ld,%016lx,%d", p, point.hash, point.cached ? 1 : 0);
+        for (const std::string& key : swept) {
+            auto found = point.parameters.find(key);
+            std::fprintf(file, ",%s", found != point.parameters.end() ? found->second.c_str() : "");
+        }
+        std::fprintf(file, ",%lu,%.9g,%.6f\n", point.msd.back().first, point.msd.back().second, point.seconds);
+    }
+    std::fclose(file);
+}
+
+int main (int argc, char** argv) {
+
+    // Read console args: those of the sweep itself, then after -- the arguments shared by all runs, as passed to amm
+    std::vector<std::string> sweepArgs, baseArgs;
+    {
+        int separator = 1;
+        while (separator < argc && std::strcmp(argv[separator], "--") != 0) ++separator;
+        sweepArgs.assign(argv + 1, argv + separator);
+        if (separator < argc) baseArgs.assign(argv + separator + 1, argv + argc);
+    }
+    std::string grid, pointsFile, cache, csvFile;
+    int threads, runThreads;
+    {
+        Arguments args(sweepArgs);
+        grid = args.read<std::string>("grid", ""); // e.g. "angular-diffusion=0.01,0.02;seed=1,2,3", every combination being run
+        pointsFile = args.read<std::string>("points", ""); // file of parameter sets, one command line per line; combined with every point of -grid
+        cache = args.read<std::string>("cache", "results/sweep-cache");
+        csvFile = args.read<std::string>("csv", "results/sweep.csv");
+        runThreads = std::max(1, args.read<int>("run-threads", 1)); // OpenMP threads within each run
+        threads = args.read<int>("threads", 0); // runs at a time, 0 for as many as the hardware threads allow
+    }
+    if (threads <= 0) threads = std::max(1, int(std::thread::hardware_concurrency()) / runThreads);
+
+    std::vector<std::vector<std::string>> listed = pointsFile.empty() ? std::vector<std::vector<std::string>>{ { } } : readPoints(pointsFile);
+    std::vector<std::vector<std::string>> gridded = expandGrid(grid);
+    std::set<std::string> swept; // keys varying across points, reported in the summary
+    std::vector<SweepPoint> points;
+    std::uint64_t version = binaryVersion();
+    for (const std::vector<std::string>& listedArgs : listed) {
+        for (const std::vector<std::string>& griddedArgs : gridded) {
+            std::map<std::string, std::string> assigned;
+            assign(assigned, baseArgs);
+            std::map<std::string, std::string> varying;
+            assign(varying, listedArgs);
+            assign(varying, griddedArgs);
+            for (const auto& pair : varying) {
+                // the kernels are selected process-wide, so that runs at a time may not differ by them
+                if (pair.first.compare("simd") == 0) {
+                    std::printf("-simd cannot be swept, pass it after -- to apply to all runs!\n");
+                    std::exit(1);
+                }
+                assigned[pair.first] = pair.second;
+                swept.insert(pair.first);
+            }
+            SweepPoint point;
+            for (const auto& pair : assigned) point.commandLine.insert(point.commandLine.end(), { "-" + pair.first, pair.second });
+            resolve(point, version);
+            points.push_back(point);
+        }
+    }
+
+    makeDirectories(cache);
+    std::vector<std::size_t> missing;
+    for (std::size_t p = 0; p < points.size(); ++p) {
+        points[p].cached = loadEntry(entryPath(cache, points[p].hash), points[p]);
+        if (!points[p].cached) missing.push_back(p);
+    }
+    std::printf("%ld points, %ld cached in %s, running %ld on %d threads (%d OpenMP threads each)...\n\n", points.size(), points.size() - missing.size(),
+        cache.c_str(), missing.size(), threads, runThreads);
+
+    // longest runs first, so that short ones fill in the gaps at the end rather than a long one starting last
+    std::stable_sort(missing.begin(), missing.end(), [&](std::size_t a, std::size_t b) {
+        return points[a].iterations * std::stoull(points[a].parameters["particles"]) > points[b].iterations * std::stoull(points[b].parameters["particles"]);
+    });
+    std::mutex printMutex;
+    std::size_t finished = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::size_t steals;
+    {
+        WorkStealingPool pool(std::size_t(threads), [runThreads](std::size_t) { omp_set_num_threads(runThreads); });
+        for (std::size_t p : missing) {
+            pool.submit([&, p]() {
+                SweepPoint& point = points[p];
+                run(point);
+                bool stored = storeEntry(entryPath(cache, point.hash), point);
+                std::lock_guard<std::mutex> lock(printMutex);
+                ++finished;
+                std::printf("[%ld/%ld] %016lx: MSD %f after %ld steps, %.2f s%s\n", finished, missing.size(), point.hash, point.msd.back().second,
+                    point.iterations, point.seconds, stored ? "" : " (could not write to the cache)");
+                std::fflush(stdout);
+            });
+        }
+        pool.wait();
+        steals = pool.getSteals();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    writeCsv(csvFile, points, swept);
+    std::printf("\nRan %ld points in %.2f s (%ld stolen between threads), wrote results of all %ld points to %s\n", missing.size(), seconds, steals,
+        points.size(), csvFile.c_str());
+    return 0;
+}